@@ -2,18 +2,46 @@
 
 #include <thread>
 #include <functional>
+#include <optional>
 #include "locking_tt.h"
+#include "shared_root.h"
+#include "cutoff_table.h"
+#include "work_stealing.h"
+#include "load_balance.h"
+#include "alloc_counter.h"
+#include "move_picker.h"
+#include "see.h"
+#include "selective.h"
+#include "stop_signal.h"
+#include "live_stats.h"
+#include "search_limits.h"
+#include "defer_policy.h"
 #include "abdada_tt.h"
 #include "compile_time_constants.h"
 
-template<bool Q_SEARCH, TT_Strategy strategy>
+/**
+ * @tparam Table Anything with the interface of ABDADA_TT, e.g. a Distributed_TT.
+ */
+template<bool Q_SEARCH, TT_Strategy strategy, class Table = ABDADA_TT<strategy>>
 class alignas (128) ABDADA_Thread { // Let's go big with the alignas just in case
 
 private:
     Board board;
     uint64_t nodes = 0;
-    ABDADA_TT<strategy>& tt;
-    std::atomic<bool>& finished;
+    Table& tt;
+    Stop_Signal& finished;
+    Stop_Poll stop_poll; // Interior nodes check finished through this, only the root reads it directly
+    Cutoff_Table& cutoffs;
+    std::size_t thread_id;
+    uint64_t nodes_saved = 0;
+    Job_Queues& jobs;
+    Deferred_Job stolen_job;
+    bool in_stolen_job = false;
+    uint64_t jobs_stolen = 0;
+    Defer_Policy defer_policy;
+    uint8_t probed_subtree_size = 0; // Subtree size of the last node we found another thread searching
+    Counter_RNG rng; // Random move order of this thread, see move_order_rng
+    Move_Order order; // Killers and history of this thread, see MOVE_ORDERING
 
     /**
      *
@@ -21,18 +49,20 @@ private:
      * @param alpha Bound passed in by reference, will be updated
      * @param beta  Bound passed in by reference, will be updated
      * @param depth
+     * @param shared Whether this node gets its proc count tracked, see Defer_Policy.
      * @return true if the TT probe produced a cutoff, i.e. the search can be skipped, and the TT entry value,
      * stored in alpha, can be returned.
      */
-    bool tt_probe_skip_search(Move& move, Eval_Type& alpha, Eval_Type& beta, int depth, bool exclusive) {
+    bool tt_probe_skip_search(Move& move, Eval_Type& alpha, Eval_Type& beta, int depth, bool exclusive, bool shared) {
         ABDADA_TT_Info tt_entry{};
-        if (tt.template get_if_exists<true>(board.hashKey, depth, tt_entry, exclusive)) {
+        if (tt.template get_if_exists<true>(board.hashKey, depth, tt_entry, exclusive, shared)) {
             assert(tt_entry.depth == depth);
             assert(tt_entry.eval != ON_EVALUATION);
 
             if (exclusive && tt_entry.proc_number > 0) { // No proc incremented
                 assert(tt_entry.type == EVALUATING);
                 alpha = ON_EVALUATION;
+                probed_subtree_size = tt_entry.subtree_size; // From an earlier search of this node, if any
                 return true; // "Cutoff" because another thread is already searching this node.
             }
 
@@ -49,8 +79,8 @@ private:
 
                 if (alpha >= beta) { // Our window is empty due to the TT hit
                     alpha = tt_entry.eval;
-                    tt.decrement_proc(board.hashKey,
-                                      depth); // We incremented this and now skip the search, so decrement again.
+                    tt.decrement_proc(board.hashKey, depth,
+                                      shared); // We incremented this and now skip the search, so decrement again.
                     return true;
                 }
                 move = tt_entry.move;
@@ -65,26 +95,119 @@ private:
         return false;
     }
 
+    /**
+     * Besides the global finished flag, we also stop if another thread refuted a shared node we are inside of.
+     */
+    [[nodiscard]] bool aborted() {
+        return stop_poll(nodes) || (CUTOFF_PROPAGATION && cutoffs.abort_requested(thread_id));
+    }
+
+    /**
+     * Called when we stop searching a node early. If another thread refuted this node, we return its cutoff value
+     * instead of our partial result, otherwise the partial result gets discarded further up anyway.
+     */
+    Eval_Type stop_node(const Shared_Node_Entry& shared_node, Eval_Type eval, uint64_t nodes_at_entry) {
+        if (shared_node.refuted()) {
+            nodes_saved += shared_node.nodes_saved(nodes - nodes_at_entry);
+            return shared_node.cutoff_eval();
+        }
+        return eval;
+    }
+
+    /**
+     * Publishes the move we just made and deferred, so that a thread without work of its own can search it.
+     */
+    void publish_job(Eval_Type beta, int depth, uint8_t subtree_size) {
+        if (WORK_STEALING && worth_sharing(subtree_size)) {
+            jobs.publish(thread_id, board, beta, depth);
+        }
+    }
+
+    /**
+     * Call this when all moves left at the current node are deferred, i.e. being searched by other threads. Instead of
+     * joining them right away, we first search a move some other thread deferred; its result goes into the TT, and by
+     * the time we get back to our own deferred moves their searches may be done. Stolen jobs don't steal again, which
+     * keeps the board we set aside here the only one.
+     */
+    void steal_job() {
+        if (!WORK_STEALING || in_stolen_job || !jobs.steal(thread_id, stolen_job)) {
+            return;
+        }
+        in_stolen_job = true;
+        jobs_stolen++;
+        std::swap(board, stolen_job.board);
+        null_window_search(stolen_job.beta, stolen_job.depth, false);
+        std::swap(board, stolen_job.board);
+        in_stolen_job = false;
+    }
+
+    /**
+     * Generates the moves in a random order. With LAZY_SHUFFLE only the first move is chosen here, the others when the
+     * search gets to them through pick_move, so a node that cuts off early skips most of the shuffle. Nodes below
+     * SHUFFLE_DEPTH keep the generation order.
+     */
     template<Movetype TYPE>
-    void generate_shuffled_moves(Movelist& moves) {
-        Movegen::legalmoves<TYPE>(board, moves);
-        thread_local static std::mt19937 mt(seed);
-
-        for (int i = 0; i < moves.size; i++) {
-            // Get a random index of the array past the current index.
-            // ... The argument is an exclusive bound.
-            //     It will not go past the array's end.
-            int randomValue = i + (mt() % (moves.size - i)); // One could try to get rid of this mod but appears not worth it in terms of performance.
-            // Swap the random element with the present element.
-            auto randomElement = moves[randomValue];
-            moves[randomValue] = moves[i];
-            moves[i] = randomElement;
+    void generate_shuffled_moves(Movelist& moves, int depth) {
+        generate_moves<TYPE>(board, moves);
+        if (depth < SHUFFLE_DEPTH) {
+            return;
         }
+        int shuffled = LAZY_SHUFFLE ? std::min(1, (int) moves.size) : moves.size;
+        for (int i = 0; i < shuffled; i++) {
+            shuffle_step(moves, i, rng);
+        }
+    }
+
+    /**
+     * @return The move at index, which with LAZY_SHUFFLE gets chosen now. Call this with increasing indices, and only
+     * once per index; the moves before index are already searched and stay where they are.
+     */
+    Move pick_move(Movelist& moves, int index, int depth) {
+        if (LAZY_SHUFFLE && index > 0 && depth >= SHUFFLE_DEPTH) { // Move 0 is chosen at generation, or the TT move
+            shuffle_step(moves, index, rng);
+        }
+        return moves[index].move;
     }
 
 public:
-    explicit ABDADA_Thread(Board& board, ABDADA_TT<strategy>& table, std::atomic<bool>& finished)
-                                                    : board(board), tt(table), finished(finished) {
+    explicit ABDADA_Thread(Board& board, Table& table, Stop_Signal& finished, Cutoff_Table& cutoffs,
+                           Job_Queues& jobs, std::size_t thread_id)
+                           : board(board), tt(table), finished(finished), stop_poll(finished), cutoffs(cutoffs),
+                             thread_id(thread_id),
+                             jobs(jobs) {
+        defer_policy.reset(table.get_defer_depth(), false);
+    }
+
+    /**
+     * @param depth The depth from which on nodes are shared, or the starting depth if adaptive.
+     * @param adaptive Whether the depth adapts to the contention this thread observes, see Defer_Policy.
+     */
+    void set_defer_policy(int32_t depth, bool adaptive) {
+        defer_policy.reset(depth, adaptive);
+    }
+
+    [[nodiscard]] int32_t get_defer_depth() const {
+        return defer_policy.depth();
+    }
+
+    [[nodiscard]] uint64_t get_nodes_saved() const {
+        return nodes_saved;
+    }
+
+    void set_live_nodes(std::atomic<uint64_t>& counter) {
+        stop_poll.publish_to(counter);
+    }
+
+    void set_rng(const Counter_RNG& stream) {
+        rng = stream;
+    }
+
+    [[nodiscard]] uint64_t get_nodes() const {
+        return nodes;
+    }
+
+    [[nodiscard]] uint64_t get_jobs_stolen() const {
+        return jobs_stolen;
     }
 
     Eval_Type q_search(Eval_Type alpha, Eval_Type beta) {
@@ -104,9 +227,14 @@ public:
             alpha = q_eval;
         }
 
+        Eval_Type stand_pat = q_eval;
         Movelist captures;
-        Movegen::legalmoves<CAPTURE>(board, captures);
+        generate_moves<CAPTURE>(board, captures);
+        order_captures(board, captures);
         for (auto& capture : captures) {
+            if (prune_capture(board, capture.move, stand_pat, alpha)) {
+                continue;
+            }
             board.makeMove(capture.move);
             Eval_Type inner_eval = -q_search(-beta, -alpha);
             board.unmakeMove(capture.move);
@@ -119,7 +247,7 @@ public:
                     alpha = q_eval;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (aborted()) { // If someone else already completed the search there is no reason for us to continue
                 return q_eval;
             }
         }
@@ -141,9 +269,14 @@ public:
             return q_eval;
         }
 
+        Eval_Type stand_pat = q_eval;
         Movelist captures;
-        Movegen::legalmoves<CAPTURE>(board, captures);
+        generate_moves<CAPTURE>(board, captures);
+        order_captures(board, captures);
         for (auto& capture : captures) {
+            if (prune_capture(board, capture.move, stand_pat, beta - 1)) {
+                continue;
+            }
             board.makeMove(capture.move);
             Eval_Type inner_eval = -nw_q_search(-beta + 1);
             board.unmakeMove(capture.move);
@@ -153,7 +286,7 @@ public:
                     break;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (aborted()) { // If someone else already completed the search there is no reason for us to continue
                 return q_eval;
             }
         }
@@ -165,95 +298,144 @@ public:
         Eval_Type eval = MIN_EVAL;
         Move tt_move = NO_MOVE;
         Eval_Type alpha = beta - 1;
-        if (tt_probe_skip_search(tt_move, alpha, beta, depth, exclusive)) { // I.e. if cutoff
+        bool shared = defer_policy.shares(depth);
+        bool skip = tt_probe_skip_search(tt_move, alpha, beta, depth, exclusive, shared);
+        if (exclusive && shared) {
+            defer_policy.record_probe(depth, skip && alpha == ON_EVALUATION);
+        }
+        if (skip) { // I.e. if cutoff
             return alpha; // TT entry value is put here
         }
 
-        ABDADA_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0}; // If we don't find a move, keep the old TT move
-        Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
-        int tt_move_index = moves.find(tt_move);
-        if (tt_move_index > 0) {
-            std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
+        ABDADA_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0, 0}; // If we don't find a move, keep the old TT move
+        Shared_Node_Entry shared_node(cutoffs, shared, board.hashKey, depth, beta, thread_id);
+        uint64_t nodes_at_entry = nodes;
+        Selectivity selectivity(board, beta, depth);
+        if (selectivity.null_move()) {
+            int null_depth = depth - 1 - null_move_reduction;
+            board.makeNullMove();
+            Eval_Type null_eval = null_depth > 0 ? -null_window_search(-beta + 1, null_depth, false)
+                                                 : -nw_q_search(-beta + 1);
+            board.unmakeNullMove();
+            if (aborted() || shared_node.refuted()) {
+                tt.decrement_proc(board.hashKey, depth, shared); // We stop searching
+                return stop_node(shared_node, eval, nodes_at_entry);
+            }
+            if (null_eval >= beta) {
+                entry.eval = null_eval;
+                entry.type = LOWER_BOUND;
+                shared_node.cutoff(null_eval, nodes - nodes_at_entry);
+                tt.template emplace<true>(board.hashKey, entry, depth, shared);
+                return null_eval;
+            }
         }
 
-        std::vector<Move> deferred_moves{};
-        deferred_moves.reserve(moves.size);
+        Move_Picker moves(board, tt_move, depth >= SHUFFLE_DEPTH ? &rng : nullptr, &order, depth);
 
-        for (int move_index = 0; move_index < moves.size; move_index++) {
-            Move move = moves[move_index].move;
+        Deferred_List deferred_moves;
+
+        int move_index = 0;
+        for (Move move = moves.next(); move != NO_MOVE; move = moves.next(), move_index++) {
+            bool quiet = !is_capture(board, move);
             board.makeMove(move);
+            if (selectivity.skip(board, quiet, move_index)) {
+                board.unmakeMove(move);
+                eval = std::max(eval, selectivity.futility_bound(depth));
+                continue;
+            }
+            int reduction = selectivity.reduction(board, quiet, move_index, depth);
             Eval_Type inner_eval;
-            if (depth > 1) {
+            if (reduction > 0) { // Reduced moves are cheap, so we search them right away instead of deferring them
+                inner_eval = -null_window_search(-beta + 1, depth - 1 - reduction, false);
+                if (inner_eval >= beta && !aborted()) { // Verify at full depth
+                    inner_eval = -null_window_search(-beta + 1, depth - 1, false);
+                }
+            } else if (depth > 1) {
                 inner_eval = -null_window_search(-beta + 1, depth - 1, move_index != 0);
                 if (inner_eval == (Eval_Type) -ON_EVALUATION) { // The overflow behavior here is questionable but works for these values
-                    deferred_moves.emplace_back(move);
+                    if (worth_deferring(probed_subtree_size)) {
+                        deferred_moves.push_back({move, probed_subtree_size});
+                        publish_job(-beta + 1, depth - 1, probed_subtree_size);
+                    } else {
+                        inner_eval = -null_window_search(-beta + 1, depth - 1, false);
+                    }
                 }
             } else {
                 inner_eval = -nw_q_search(-beta + 1);
             }
             board.unmakeMove(move);
 
+            if (aborted() || shared_node.refuted()) { // Checked before using inner_eval, which an abort makes garbage
+                tt.decrement_proc(board.hashKey, depth, shared); // We stop searching
+                return stop_node(shared_node, eval, nodes_at_entry);
+            }
             if (inner_eval > eval) {
                 eval = inner_eval;
                 entry.move = move;
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
+                    shared_node.cutoff(eval, nodes - nodes_at_entry);
                     break;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
-                tt.decrement_proc(board.hashKey, depth); // We stop searching
-                return eval;
-            }
         }
 
-        for (Move move : deferred_moves) { // In particular no leaf is deferred so there's always a search to be done here
+        if (!deferred_moves.empty() && entry.type != LOWER_BOUND) {
+            steal_job();
+        }
+        order_deferred(deferred_moves);
+        for (auto& deferred : deferred_moves) { // In particular no leaf is deferred so there's always a search to be done here
+            if (entry.type == LOWER_BOUND) {
+                break;
+            }
+            Move move = deferred.move;
             board.makeMove(move);
             Eval_Type inner_eval;
             inner_eval = -null_window_search(-beta + 1, depth - 1, false);
             board.unmakeMove(move);
 
+            if (aborted() || shared_node.refuted()) {
+                tt.decrement_proc(board.hashKey, depth, shared); // We stop searching
+                return stop_node(shared_node, eval, nodes_at_entry);
+            }
             if (inner_eval > eval) {
                 eval = inner_eval;
                 entry.move = move;
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
+                    shared_node.cutoff(eval, nodes - nodes_at_entry);
                     break;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
-                tt.decrement_proc(board.hashKey, depth); // We stop searching
-                return eval;
-            }
         }
 
         entry.eval = eval;
-        tt.template emplace<true>(board.hashKey, entry, depth);
+        if constexpr (SUBTREE_SIZES) {
+            entry.subtree_size = subtree_size_log(nodes - nodes_at_entry);
+        }
+        tt.template emplace<true>(board.hashKey, entry, depth, shared);
+        defer_policy.record_subtree(depth, nodes - nodes_at_entry);
         return eval;
     }
 
     Eval_Type pv_search(Eval_Type alpha, Eval_Type beta, int depth) {
         Eval_Type eval = MIN_EVAL;
         Move tt_move = NO_MOVE;
-        if (tt_probe_skip_search(tt_move, alpha, beta, depth, false)) { // I.e. if cutoff
+        bool shared = defer_policy.shares(depth);
+        if (tt_probe_skip_search(tt_move, alpha, beta, depth, false, shared)) { // I.e. if cutoff
             return alpha; // TT entry value is put here
         }
 
-        ABDADA_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0}; // If we don't find a move, keep the old TT move
-        Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
-        int tt_move_index = moves.find(tt_move);
-        if (tt_move_index > 0) {
-            std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
-        }
+        ABDADA_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0, 0}; // If we don't find a move, keep the old TT move
+        uint64_t nodes_at_entry = nodes;
+        Move_Picker moves(board, tt_move, depth >= SHUFFLE_DEPTH ? &rng : nullptr, &order, depth);
 
-        std::vector<Move> deferred_moves{};
-        deferred_moves.reserve(moves.size);
+        Deferred_List deferred_moves;
 
         bool search_full_window = true; // TODO can this be removed?
-        for (int move_index = 0; move_index < moves.size; move_index++) {
-            Move move = moves[move_index].move;
+        for (Move move = moves.next(); move != NO_MOVE; move = moves.next()) {
             board.makeMove(move);
             Eval_Type inner_eval = MAX_EVAL; // Hack so that further down below inner eval is bigger than alpha if no search was done
             if (depth == 1) {
@@ -262,7 +444,12 @@ public:
                 if (!search_full_window) {
                     inner_eval = -null_window_search(-alpha, depth - 1, true);
                     if (inner_eval == (Eval_Type) -ON_EVALUATION) {
-                        deferred_moves.emplace_back(move);
+                        if (worth_deferring(probed_subtree_size)) {
+                            deferred_moves.push_back({move, probed_subtree_size});
+                            publish_job(-alpha, depth - 1, probed_subtree_size);
+                        } else {
+                            inner_eval = -null_window_search(-alpha, depth - 1, false);
+                        }
                     }
                 }
                 if (inner_eval > alpha) {
@@ -277,6 +464,7 @@ public:
                 entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
                 if (eval > alpha) {
@@ -285,13 +473,18 @@ public:
                 }
             }
 
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
-                tt.decrement_proc(board.hashKey, depth); // We stop searching
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
+                tt.decrement_proc(board.hashKey, depth, shared); // We stop searching
                 return eval;
             }
         }
 
-        for (auto& move : deferred_moves) { // We never enter this at depth 1, also never search full window right away.
+        if (!deferred_moves.empty() && entry.type != LOWER_BOUND) {
+            steal_job();
+        }
+        order_deferred(deferred_moves);
+        for (auto& deferred : deferred_moves) { // We never enter this at depth 1, also never search full window right away.
+            Move move = deferred.move;
             board.makeMove(move);
             Eval_Type inner_eval = -null_window_search(-alpha, depth - 1, false);
             if (inner_eval > alpha) {
@@ -304,6 +497,7 @@ public:
                 entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
                 if (eval > alpha) {
@@ -312,14 +506,17 @@ public:
                 }
             }
 
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
-                tt.decrement_proc(board.hashKey, depth); // We stop searching
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
+                tt.decrement_proc(board.hashKey, depth, shared); // We stop searching
                 return eval;
             }
         }
 
         entry.eval = eval;
-        tt.template emplace<true>(board.hashKey, entry, depth);
+        if constexpr (SUBTREE_SIZES) {
+            entry.subtree_size = subtree_size_log(nodes - nodes_at_entry);
+        }
+        tt.template emplace<true>(board.hashKey, entry, depth, shared);
         return eval;
     }
 
@@ -344,24 +541,25 @@ public:
 
         Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
         Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
+        generate_shuffled_moves<ALL>(moves, depth);
         int tt_move_index = moves.find(tt_move);
         if (tt_move_index > 0) {
             std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
         }
-        for (auto& move : moves) {
-            board.makeMove(move.move);
+        for (int move_index = 0; move_index < moves.size; move_index++) {
+            Move move = pick_move(moves, move_index, depth);
+            board.makeMove(move);
             Eval_Type inner_eval;
             if (depth > 1) {
                 inner_eval = -nega_max(-beta, -alpha, depth - 1);
             } else {
                 inner_eval = -q_search(-beta, -alpha);
             }
-            board.unmakeMove(move.move);
+            board.unmakeMove(move);
 
             if (inner_eval > eval) {
                 eval = inner_eval;
-                entry.move = move.move; // If it stays this way, this is the best move
+                entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
                     break;
@@ -371,8 +569,8 @@ public:
                     entry.type = EXACT; // We raised alpha, so it's no longer a lower bound, either exact or upper bound
                 }
 
-                if (finished) { // If someone else already completed the search there is no reason for us to continue
-                    tt.decrement_proc(board.hashKey, depth); // We stop searching
+                if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
+                    tt.decrement_proc(board.hashKey, depth, shared); // We stop searching
                     return eval;
                 }
             }
@@ -383,30 +581,34 @@ public:
     }*/
 
     template<class Search_Result, bool PV_Search>
-    void root_max(Eval_Type alpha, Eval_Type beta, int depth, Search_Result& result, std::atomic<uint64_t>& total_node_count) {
+    void root_max(Eval_Type alpha, Eval_Type beta, int depth, Shared_Root& root, Search_Result& result, std::atomic<uint64_t>& total_node_count) {
         nodes = 0;
+        order.new_iteration();
+        stop_poll.reset();
+        nodes_saved = 0;
+        jobs_stolen = 0;
         assert(depth > 0);
         Eval_Type eval = MIN_EVAL;
         Move tt_move = NO_MOVE;
-        if (tt_probe_skip_search(tt_move, alpha, beta, depth, false)) { // This can probably never happen but maybe in parallel search
+        bool shared = defer_policy.shares(depth);
+        if (tt_probe_skip_search(tt_move, alpha, beta, depth, false, shared)) { // This can probably never happen but maybe in parallel search
             return; // I'm claiming that if this happens, then we already have a search result from another thread, so we don't need to return anything
         }
 
         Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
+        generate_shuffled_moves<ALL>(moves, depth);
         int tt_move_index = moves.find(tt_move);
         if (tt_move_index > 0) {
             std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
         }
 
-        std::vector<Move> deferred_moves{};
-        deferred_moves.reserve(moves.size);
+        Deferred_List deferred_moves;
 
         Move best_move = NO_MOVE;
 
         bool search_full_window = true;
         for (int move_index = 0; move_index < moves.size; move_index++) {
-            Move move = moves[move_index].move;
+            Move move = pick_move(moves, move_index, depth);
             board.makeMove(move);
             Eval_Type inner_eval = MAX_EVAL;
             if (depth == 1) {
@@ -420,7 +622,12 @@ public:
                         if constexpr (DEBUG_OUTPUTS) {
                             std::cout << "Deferring " << convertMoveToUci(move) << std::endl;
                         }
-                        deferred_moves.emplace_back(move);
+                        if (worth_deferring(probed_subtree_size)) {
+                            deferred_moves.push_back({move, probed_subtree_size});
+                            publish_job(-alpha, depth - 1, probed_subtree_size);
+                        } else {
+                            inner_eval = -null_window_search(-alpha, depth - 1, false);
+                        }
                     }
                 }
                 if (inner_eval > alpha){
@@ -444,6 +651,11 @@ public:
             }
             board.unmakeMove(move);
 
+            if (finished.is_set()) { // Before using inner_eval, which an abort makes garbage
+                tt.decrement_proc(board.hashKey, depth, shared); // We stop searching
+                total_node_count += nodes;
+                return;
+            }
             if (inner_eval > eval) {
                 eval = inner_eval;
                 best_move = move;
@@ -454,15 +666,15 @@ public:
                     alpha = eval;
                 }
             }
-
-            if (finished) {
-                tt.decrement_proc(board.hashKey, depth); // We stop searching
-                total_node_count += nodes;
-                return;
-            }
+            root.record_best(best_move, eval); // So a halt can still report what we completed
         }
 
-        for (Move move : deferred_moves) {
+        if (!deferred_moves.empty() && eval < beta) {
+            steal_job();
+        }
+        order_deferred(deferred_moves);
+        for (auto& deferred : deferred_moves) {
+            Move move = deferred.move;
             board.makeMove(move);
             Eval_Type inner_eval = MAX_EVAL;
             if constexpr (!PV_Search) {
@@ -481,6 +693,11 @@ public:
             }
             board.unmakeMove(move);
 
+            if (finished.is_set()) { // Before using inner_eval, which an abort makes garbage
+                tt.decrement_proc(board.hashKey, depth, shared); // We stop searching
+                total_node_count += nodes;
+                return;
+            }
             if (inner_eval > eval) {
                 eval = inner_eval;
                 best_move = move;
@@ -491,18 +708,13 @@ public:
                     alpha = eval;
                 }
             }
-
-            if (finished) {
-                tt.decrement_proc(board.hashKey, depth); // We stop searching
-                total_node_count += nodes;
-                return;
-            }
+            root.record_best(best_move, eval); // So a halt can still report what we completed
         }
 
 
-        tt.template emplace<true>(board.hashKey, {eval, best_move, (int8_t) depth, EXACT, 0}, depth);
+        tt.template emplace<true>(board.hashKey, {eval, best_move, (int8_t) depth, EXACT, 0, 0}, depth, shared);
 
-        bool i_am_first = !finished.exchange(true);
+        bool i_am_first = finished.stop();
 
         if (i_am_first) { // The first thread to finish gets to write the search result
             result.move = best_move;
@@ -511,42 +723,214 @@ public:
         }
         total_node_count += nodes;
     }
+
+    /**
+     * Generates the root moves of a cooperative root search, with the TT move first. Call this before starting the
+     * threads, all of them will search this same move list.
+     */
+    void prepare_root(Shared_Root& root, int depth) {
+        Move tt_move = NO_MOVE;
+        ABDADA_TT_Info tt_entry{};
+        if (tt.template get_if_exists<false>(board.hashKey, depth, tt_entry, false) && tt_entry.type != EVALUATING) {
+            tt_move = tt_entry.move;
+        } else if (tt.template get_if_exists<false>(board.hashKey, depth - 1, tt_entry, false)) {
+            tt_move = tt_entry.move;
+        }
+        generate_moves<ALL>(board, root.moves);
+        for (int i = 0; i < root.moves.size; i++) { // Threads claim root moves by index, so they all get shuffled now
+            shuffle_step(root.moves, i, rng);
+        }
+        int tt_move_index = root.moves.find(tt_move);
+        if (tt_move_index > 0) {
+            std::swap(root.moves[0], root.moves[tt_move_index]); // Search the TT move first
+        }
+    }
+
+    /**
+     * Root search where the threads split the root moves between them via the shared root, see Shared_Root. Claiming
+     * a root move replaces the exclusive probe, so the root children are always searched non-exclusively; threads
+     * helping out with an unfinished root move then share its subtree the usual ABDADA way.
+     */
+    template<class Search_Result, bool PV_Search>
+    void cooperative_root_max(int depth, Shared_Root& root, Search_Result& result, std::atomic<uint64_t>& total_node_count) {
+        nodes = 0;
+        order.new_iteration();
+        stop_poll.reset();
+        nodes_saved = 0;
+        jobs_stolen = 0;
+        assert(depth > 0);
+        if (root.moves.size == 0) { // Nothing to split, whoever gets here first reports the empty result
+            if (finished.stop()) {
+                result.move = NO_MOVE;
+                result.eval = MIN_EVAL;
+                result.depth = depth;
+            }
+            return;
+        }
+        int move_index = 0;
+        while (move_index < root.moves.size) {
+            Move move = root.moves[move_index].move;
+            Eval_Type alpha = root.alpha; // Pick up the best bound any thread has proven so far
+            board.makeMove(move);
+            Eval_Type inner_eval = MAX_EVAL;
+            if (depth == 1) {
+                inner_eval = -q_search(-MAX_EVAL, -alpha);
+            } else if constexpr (!PV_Search) {
+                //inner_eval = -nega_max(-MAX_EVAL, -alpha, depth - 1);
+            } else {
+                if (move_index != 0) {
+                    inner_eval = -null_window_search(-alpha, depth - 1, false);
+                }
+                if (inner_eval > alpha) {
+                    inner_eval = -pv_search(-MAX_EVAL, -alpha, depth - 1);
+                }
+            }
+            board.unmakeMove(move);
+
+            if (finished.is_set()) { // Our result may be from an aborted search, and someone else completed the iteration
+                break;
+            }
+            if (root.complete_move(move_index, move, inner_eval)) { // We completed the last root move
+                tt.template emplace<false>(board.hashKey, {root.best_eval, root.best_move, (int8_t) depth, EXACT, 0, 0}, depth);
+                finished.stop();
+                result.move = root.best_move;
+                result.eval = root.best_eval;
+                result.depth = depth;
+                break;
+            }
+            move_index = root.claim_move(move_index);
+            if (move_index < root.moves.size && root.next_move > root.moves.size) { // Only helping out is left
+                steal_job();
+            }
+        }
+        total_node_count += nodes;
+    }
 };
 
-template<bool Q_SEARCH, TT_Strategy strategy>
+/**
+ * Nodes from the defer depth upwards are searched the ABDADA way, nodes below it the Lazy SMP way, since the TT does no
+ * proc bookkeeping for them. So setting the defer depth at runtime switches between plain ABDADA (the default
+ * DEFER_DEPTH) and a hybrid that only synchronizes near the root. The threads start out with the defer depth of the TT,
+ * set_defer_policy overrides it and can make every thread adapt it on its own, see Defer_Policy.
+ */
+template<bool Q_SEARCH, TT_Strategy strategy, class Table = ABDADA_TT<strategy>>
 class ABDADA_Search {
 
-    std::atomic<bool> finished = false;
+    Stop_Signal finished;
     size_t num_threads;
-    std::vector<ABDADA_Thread<Q_SEARCH, strategy>> searchers;
+    uint64_t seed = 0;
+    Cutoff_Table cutoffs;
+    Job_Queues jobs;
+    Live_Stats stats;
+    std::chrono::milliseconds report_interval{0};
+    std::function<void(const Search_Progress&)> report = print_progress;
+    Search_Clock clock;
+    std::vector<ABDADA_Thread<Q_SEARCH, strategy, Table>> searchers;
 
 public:
-    ABDADA_Search(size_t num_threads, Board& board, ABDADA_TT<strategy>& table) : num_threads(num_threads),
-                                      searchers(num_threads, ABDADA_Thread<Q_SEARCH, strategy>(board, table, finished)) {
+    ABDADA_Search(size_t num_threads, Board& board, Table& table)
+            : num_threads(num_threads), cutoffs(num_threads), jobs(num_threads), stats(num_threads) {
+        searchers.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; i++) {
+            searchers.emplace_back(board, table, finished, cutoffs, jobs, i);
+            searchers[i].set_live_nodes(stats.thread_nodes(i));
+        }
+    }
+
+    /**
+     * Sets the defer policy of all threads, see Defer_Policy. Takes precedence over the defer depth of the TT.
+     */
+    void set_defer_policy(int32_t depth, bool adaptive) {
+        for (auto& searcher : searchers) {
+            searcher.set_defer_policy(depth, adaptive);
+        }
+    }
+
+    /**
+     * Reports the progress of every search to report each interval, on a separate thread. An interval of 0 turns it off.
+     */
+    void set_reporting(std::chrono::milliseconds interval,
+                       std::function<void(const Search_Progress&)> callback = print_progress) {
+        report_interval = interval;
+        report = std::move(callback);
+    }
+
+    /**
+     * Ends the running search, e.g. an infinite one; thread safe. The search returns the result of the last iteration
+     * it completed, or the best root move completed in the one it got halted in.
+     */
+    void halt() {
+        clock.halt();
+    }
+
+    /**
+     * Seeds the pseudo random eval and, with DETERMINISTIC_SEARCH, the move orders of the threads.
+     */
+    void set_seed(uint64_t search_seed) {
+        seed = search_seed;
     }
 
     /**
      *
      * @tparam Search_Result
      * @tparam PV_Search
-     * @param up_to_depth Search for each depth from 1 to up_to_depth through iterative deepening.
+     * @param limits Search for each depth from 1 on through iterative deepening, until reaching one of the limits.
      * @param iteration Optional parameter, if passed will be printed in the output. Useful for automated benchmarks.
+     * @tparam Cooperative_Root If true, the threads split the root moves between them and share their root bound
+     * instead of each searching all root moves independently, see Shared_Root.
      * @return
      */
-    template<class Search_Result, bool PV_Search>
-    Search_Result parallel_search(int up_to_depth, int iteration = 0) {
+    template<class Search_Result, bool PV_Search, bool Cooperative_Root = false>
+    Search_Result parallel_search(const Search_Limits& limits, int iteration = 0) {
         Search_Result result;
-        for (int depth = 1; depth <= up_to_depth; depth++) {
+        clock.start_search(limits, finished);
+        stats.start_search();
+        std::optional<Progress_Reporter> reporter;
+        if (report_interval.count() > 0) {
+            reporter.emplace(stats, report_interval, report);
+        }
+        std::optional<Limit_Watcher> watcher;
+        if (clock.needs_watching()) {
+            watcher.emplace(clock, stats);
+        }
+        double last_duration = 0, previous_duration = 0;
+        for (int depth = 1; depth <= limits.depth; depth++) {
+            if (depth > 1 && clock.soft_limit_reached(last_duration, iteration_growth(last_duration, previous_duration))) {
+                break; // Better to stop now than to start an iteration we would have to abandon
+            }
             std::vector<std::thread> search_threads;
             Eval_Type alpha = MIN_EVAL;
             Eval_Type beta = MAX_EVAL;
-            finished = false;
+            finished.reset();
+            if (clock.is_halted()) { // Checked after the reset, which would undo the stop signal of the halt
+                break;
+            }
+            cutoffs.reset();
+            jobs.clear();
+            Load_Balance load_balance(num_threads);
+            std::atomic<uint64_t> allocations = 0;
+            std::atomic<uint64_t> movegen_time = 0;
             std::atomic<uint64_t > node_count = 0;
+            Shared_Root shared_root;
+            for (size_t i = 0; i < num_threads; i++) {
+                searchers[i].set_rng(move_order_rng(seed, i, depth));
+            }
+            stats.start_iteration(depth);
             auto start = std::chrono::high_resolution_clock::now();
+            if constexpr (Cooperative_Root) {
+                searchers[0].prepare_root(shared_root, depth);
+            }
             for (size_t i = 0; i < num_threads; i++) {
-                auto func = std::bind(&ABDADA_Thread<Q_SEARCH, strategy>::template root_max<Search_Result, PV_Search>,
-                                      &searchers[i], alpha, beta, depth, std::ref(result), std::ref(node_count));
-                search_threads.emplace_back(func);
+                if constexpr (Cooperative_Root) {
+                    auto func = std::bind(&ABDADA_Thread<Q_SEARCH, strategy, Table>::template cooperative_root_max<Search_Result, PV_Search>,
+                                          &searchers[i], depth, std::ref(shared_root), std::ref(result), std::ref(node_count));
+                    search_threads.emplace_back(load_balance.timed(seeded(timing_movegen(counting_allocations(func, allocations), movegen_time), seed, i), i));
+                } else {
+                    auto func = std::bind(&ABDADA_Thread<Q_SEARCH, strategy, Table>::template root_max<Search_Result, PV_Search>,
+                                          &searchers[i], alpha, beta, depth, std::ref(shared_root), std::ref(result),
+                                          std::ref(node_count));
+                    search_threads.emplace_back(load_balance.timed(seeded(timing_movegen(counting_allocations(func, allocations), movegen_time), seed, i), i));
+                }
             }
             for (auto &thread: search_threads) {
                 thread.join();
@@ -554,10 +938,50 @@ public:
             auto end = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double> duration = end - start;
 
+            if (clock.is_halted() && result.depth != depth) { // Nobody completed the iteration, so keep the last result
+                bool first_move_done = !Cooperative_Root || shared_root.done[0]; // The old best move got its new score
+                if (first_move_done && shared_root.best_move != NO_MOVE) { // Unless root moves of this one got completed
+                    result.move = shared_root.best_move;
+                    result.eval = shared_root.best_eval;
+                }
+                break;
+            }
+            previous_duration = last_duration;
+            last_duration = duration.count();
             result.duration = duration.count();
             result.nodes = node_count;
+            stats.finish_iteration(node_count, result.move, result.eval);
+            result.nodes_saved = 0;
+            result.jobs_stolen = 0;
+            for (size_t i = 0; i < num_threads; i++) {
+                result.nodes_saved += searchers[i].get_nodes_saved();
+                result.jobs_stolen += searchers[i].get_jobs_stolen();
+                load_balance.set_nodes(i, searchers[i].get_nodes());
+            }
+            result.imbalance = load_balance.imbalance();
+            result.heap_allocations = allocations;
+            result.movegen_time = (double) movegen_time / 1e9;
+            result.defer_depth = 0;
+            for (auto& searcher : searchers) {
+                result.defer_depth += (double) searcher.get_defer_depth() / (double) num_threads;
+            }
+            result.idle_time = load_balance.idle_time(end);
+            result.stop_latency = load_balance.stop_latency(finished.get_stop_time());
             result.print_table(iteration, num_threads);
         }
+        watcher.reset(); // So that it can't halt the search after we finished it
+        if (clock.is_halted()) {
+            result.halt_latency = clock.halt_latency();
+        }
+        clock.finish_search();
         return result;
     }
+
+    /**
+     * @param up_to_depth Search for each depth from 1 to up_to_depth through iterative deepening.
+     */
+    template<class Search_Result, bool PV_Search, bool Cooperative_Root = false>
+    Search_Result parallel_search(int up_to_depth, int iteration = 0) {
+        return parallel_search<Search_Result, PV_Search, Cooperative_Root>(Search_Limits::to_depth(up_to_depth), iteration);
+    }
 };
@@ -3,9 +3,12 @@
 #include <cstdint>
 #include <iostream>
 #include <vector>
+#include <span>
+#include <new>
 #include <bit>
 #include "compile_time_constants.h"
 #include "transposition_table.h"
+#include "shared_memory.h"
 #include "chess.hpp"
 #include "locking_tt.h"
 
@@ -18,7 +21,8 @@ struct __attribute__((packed)) ABDADA_TT_Info {
     Eval_Type eval;
     Chess::Move move;
     int8_t depth;
-    Bound_Type type;
+    Bound_Type type : 2;
+    uint8_t subtree_size : 6; // log2 of the nodes the last search of this entry took, 0 if unknown, see subtree_size_log
     std::int8_t proc_number;
 };
 
@@ -33,13 +37,18 @@ private:
 
         /**
          * We don't lock anything here, it is the users responsibility to make sure the surrounding structs are locked.
-         * @param other
-         * @return
+         * @param other_key The stored key of other, which carries its age.
+         * @param age The age of the current search, which both entries are ranked against.
+         * @return true if this entry should rather be replaced than other.
          */
-        bool operator<(ABDADA_TT_Info& other) const {
+        bool worse_than(uint64_t other_key, const ABDADA_TT_Info& other, uint8_t age) const {
             if (value.proc_number > 0) {  // If we are currently searching on this entry, then this should not be replaced,
                 return false;       // so gets higher priority.
             }
+            uint64_t our_age = searches_ago(key, age), other_age = searches_ago(other_key, age);
+            if (our_age != other_age) { // Entries of earlier searches go first, however deep they are
+                return our_age > other_age;
+            }
             if (value.type == EXACT && other.type != EXACT) {
                 return false;
             } else if (value.type != EXACT && other.type == EXACT) {
@@ -53,9 +62,34 @@ private:
         Entry entries[entries_per_bucket];
     };
 
+    static_assert(sizeof(Entry) == 16, "Entries have to stay 16 bytes so that a bucket fills exactly one cache line");
+
 public:
     explicit ABDADA_TT(uint64_t size_in_mb = 8192) :
-                size((1 << 20) * std::bit_floor(size_in_mb) / sizeof(Bucket)), mask(size - 1), table(size) {
+                size((1 << 20) * std::bit_floor(size_in_mb) / sizeof(Bucket)), mask(size - 1), heap_table(size),
+                table(heap_table) {
+    }
+
+    /**
+     * Places the table in a shared segment instead of the heap, so that several processes can search on it. A new
+     * segment is all zeros, which already is an empty table.
+     */
+    explicit ABDADA_TT(Shared_Segment& segment) :
+                size(std::bit_floor(segment.table_bytes() / sizeof(Bucket))), mask(size - 1),
+                table(std::launder(static_cast<Bucket*>(segment.table_memory())), size) {
+    }
+
+    /**
+     * Sets the depth from which on nodes are searched the ABDADA way, i.e. get their proc counts tracked and can be
+     * deferred. Below it the TT behaves like a plain shared TT, so threads search those nodes independently the Lazy SMP
+     * way. Only change this between searches.
+     */
+    void set_defer_depth(int32_t depth) {
+        defer_depth = depth;
+    }
+
+    [[nodiscard]] int32_t get_defer_depth() const {
+        return defer_depth;
     }
 
     /**
@@ -74,7 +108,22 @@ public:
             }
         }
         std::cout << "Table elements: " << num_elements << ", exact entries: " << exact_entries << ", total writes: "
-                  << writes << " bucket count " << table.size() << ", bucket capacity: " << table.capacity() << std::endl;
+                  << writes << " bucket count " << table.size() << ", bucket capacity: " << heap_table.capacity() << std::endl;
+    }
+
+    /**
+     * Permille of the first 1000 entries that the current search wrote or used, which is how UCI reports hashfull.
+     * Reads without locking, it is only an estimate anyway.
+     */
+    [[nodiscard]] int hashfull() const {
+        uint64_t used = 0, sampled = 0;
+        for (std::size_t i = 0; i < table.size() && sampled < 1000; i++) {
+            for (auto & entry : table[i].entries) {
+                used += entry.key != 0 && searches_ago(entry.key, age) == 0;
+                sampled++;
+            }
+        }
+        return sampled == 0 ? 0 : (int) (used * 1000 / sampled);
     }
 
     /**
@@ -105,7 +154,7 @@ public:
     void replace<TWO_TWO_SPLIT>(Entry entries[entries_per_bucket], uint64_t key, ABDADA_TT_Info value) {
         for (int i = 0; i < 4; i++) {
             auto & entry = entries[i];
-            if (entry < value) { // last slot is always replace
+            if (entry.worse_than(key, value, age)) { // last slot is always replace
                 std::swap(entry.value, value);
                 std::swap(entry.key, key);
             }
@@ -121,7 +170,7 @@ public:
     void replace<REPLACE_LAST_ENTRY>(Entry entries[entries_per_bucket], uint64_t key, ABDADA_TT_Info value) {
         for (int i = 0; i < 4; i++) {
             auto & entry = entries[i];
-            if (entry < value || i == 3) { // last slot is always replace
+            if (entry.worse_than(key, value, age) || i == 3) { // last slot is always replace
                 std::swap(entry.value, value);
                 std::swap(entry.key, key);
             }
@@ -132,7 +181,7 @@ public:
     void replace<DEPTH_FIRST>(Entry entries[entries_per_bucket], uint64_t key, ABDADA_TT_Info value) {
         for (int i = 0; i < 4; i++) {
             auto & entry = entries[i];
-            if (entry < value) {
+            if (entry.worse_than(key, value, age)) {
                 std::swap(entry.value, value);
                 std::swap(entry.key, key);
             }
@@ -145,9 +194,10 @@ public:
      * @param key
      * @param value
      * @param depth
+     * @param shared Whether the caller tracks this node's proc count, see get_if_exists.
      */
     template<bool DECREMENTING>
-    void emplace(uint64_t key, ABDADA_TT_Info value, int32_t depth) {
+    void emplace(uint64_t key, ABDADA_TT_Info value, int32_t depth, bool shared) {
         if constexpr (!use_tt) {
             return;
         }
@@ -157,15 +207,16 @@ public:
         auto & entries = table[position].entries;
         for (int i = 0; i < 4; i++) { // Check if the entry already exists
             auto & entry = entries[i];
-            if (entry.key == key) {
+            if (same_position(entry.key, key)) {
                 assert(entry.value.depth == depth);
                 assert(value.depth == depth);
+                entry.key = aged_key(key, age);
                 value.proc_number = entry.value.proc_number; // We will write the value to that position so remember the proc count
                 if constexpr (DECREMENTING) {
-                    if (depth >= DEFER_DEPTH) {
+                    if (shared) {
                         if (value.proc_number > 0) {
                             value.proc_number--;
-                            while (i < 3 && entries[i] < entries[i + 1].value) { // Decrementing the proc counter decreases our priority
+                            while (i < 3 && entries[i].worse_than(entries[i + 1].key, entries[i + 1].value, age)) { // Decrementing the proc counter decreases our priority
                                 std::swap(entries[i].value, entries[i + 1].value); // So we should move down as far as possible to not
                                 std::swap(entries[i].key, entries[i + 1].key); // replace higher priority entries instead of us
                                 i++;
@@ -178,7 +229,12 @@ public:
             }
         }
         writes++; // Entry does not exist yet so we create it
-        replace<strategy>(entries, key, value); // Try to replace an existing (possibly empty) entry.
+        replace<strategy>(entries, aged_key(key, age), value); // Try to replace an existing (possibly empty) entry.
+    }
+
+    template<bool DECREMENTING>
+    void emplace(uint64_t key, ABDADA_TT_Info value, int32_t depth) {
+        emplace<DECREMENTING>(key, value, depth, depth >= defer_depth);
     }
 
     /** TODO if ever used this should probably be looked at again
@@ -190,7 +246,7 @@ public:
         std::lock_guard<Spin_Lock> guard(table[position].entries[0].spin_lock);
         auto & entries = table[position].entries;
         for (auto& entry : entries) {
-            if (entry.key == key) {
+            if (same_position(entry.key, key)) {
                 if constexpr (INCREMENTING) { // TODO defer depth
                     if (entry.value.proc_number == 0 || !exclusive) { // This node is likely getting searched
                         entry.value.proc_number++;
@@ -203,14 +259,21 @@ public:
     }
 
     void decrement_proc(uint64_t key, int32_t depth) {
+        decrement_proc(key, depth, depth >= defer_depth);
+    }
+
+    void decrement_proc(uint64_t key, int32_t depth, bool shared) {
+        if (!shared) { // We never incremented anything for this node
+            return;
+        }
         auto position = pos(key, depth);
         std::lock_guard<Spin_Lock> guard(table[position].entries[0].spin_lock);
         auto & entries = table[position].entries;
         for (int i = 0; i < 4; i++) { // NOLINT(readability-use-anyofallof)
             auto& entry = entries[i];
-            if (entry.key == key) {
-                entry.value.proc_number--;
-                while (i < 3 && entries[i] < entries[i + 1].value) { // Decrementing the proc counter decreases our priority
+            if (same_position(entry.key, key) && entry.value.proc_number > 0) { // The entry may have been replaced and
+                entry.value.proc_number--;                                       // created anew since our claim
+                while (i < 3 && entries[i].worse_than(entries[i + 1].key, entries[i + 1].value, age)) { // Decrementing the proc counter decreases our priority
                     std::swap(entries[i].value, entries[i + 1].value); // So we should move down as far as possible to not
                     std::swap(entries[i].key, entries[i + 1].key); // replace higher priority entries instead of us
                     i++;
@@ -221,9 +284,19 @@ public:
 
     /**
      * Returns true and puts the value into the third parameter reference, if such an entry exists, and false otherwise.
+     * Proc counts are only tracked for nodes at or above the defer depth of the TT.
      */
     template<bool INCREMENTING>
     [[nodiscard]] bool get_if_exists(uint64_t key, int32_t depth, ABDADA_TT_Info& info, bool exclusive) {
+        return get_if_exists<INCREMENTING>(key, depth, info, exclusive, depth >= defer_depth);
+    }
+
+    /**
+     * As above, but the caller decides whether this node is shared, i.e. gets its proc count tracked. A caller must
+     * pass the same decision to the matching emplace and decrement_proc calls.
+     */
+    template<bool INCREMENTING>
+    [[nodiscard]] bool get_if_exists(uint64_t key, int32_t depth, ABDADA_TT_Info& info, bool exclusive, bool shared) {
         if constexpr (!use_tt) {
             return false;
         }
@@ -234,14 +307,15 @@ public:
             auto &entries = table[position].entries;
             for (int i = 0; i < 4; i++) {
                 auto &entry = entries[i];
-                if (entry.key == key) {
+                if (same_position(entry.key, key)) {
+                    entry.key = aged_key(key, age); // The current search still uses it
                     info = entry.value;
                     if constexpr (INCREMENTING) {
-                        if (depth >= DEFER_DEPTH) { // Otherwise we don't want to change proc_count
+                        if (shared) { // Otherwise we don't want to change proc_count
                             if (entry.value.type != EXACT // Otherwise cutoff and no search
                                 && (entry.value.proc_number == 0 || !exclusive)) { // Otherwise skip and no search
                                 entry.value.proc_number++; // If likely search, increment proc_number
-                                while (i > 0 && entries[i - 1] < entries[i].value) {
+                                while (i > 0 && entries[i - 1].worse_than(entries[i].key, entries[i].value, age)) {
                                     // Incrementing the proc counter increases our priority
                                     // So we should move up as far as possible to not get replaced
                                     std::swap(entries[i - 1].value, entries[i].value);
@@ -256,17 +330,57 @@ public:
             }
         }
         if constexpr (INCREMENTING) { // I.e. we are planning to search this
-            if (depth >= DEFER_DEPTH) { // The entry does not exist yet, but we want to search it, so create new entry
+            if (shared) { // The entry does not exist yet, but we want to search it, so create new entry
                 info.proc_number = 1; // and set the search processors to 1.
                 info.depth = depth;
                 info.type = EVALUATING;
                 info.move = NO_MOVE;
-                emplace<false>(key, info, depth);
+                info.subtree_size = 0;
+                emplace<false>(key, info, depth, shared);
             }
         }
         return false;
     }
 
+    /**
+     * Counts one more searcher of a shared node whatever its entry says, exact or not, and creates the entry if there is
+     * none. For claims made on other nodes, which get released no matter what the entry turned into, see Distributed_TT.
+     * @return The entry with the claim counted.
+     */
+    ABDADA_TT_Info claim(uint64_t key, int32_t depth) {
+        auto position = pos(key, depth);
+        std::lock_guard<Spin_Lock> guard(table[position].entries[0].spin_lock);
+        auto & entries = table[position].entries;
+        for (int i = 0; i < 4; i++) {
+            if (same_position(entries[i].key, key)) {
+                entries[i].key = aged_key(key, age);
+                entries[i].value.proc_number++;
+                ABDADA_TT_Info info = entries[i].value;
+                while (i > 0 && entries[i - 1].worse_than(entries[i].key, entries[i].value, age)) { // Like get_if_exists
+                    std::swap(entries[i - 1].value, entries[i].value);
+                    std::swap(entries[i - 1].key, entries[i].key);
+                    i--;
+                }
+                return info;
+            }
+        }
+        ABDADA_TT_Info info{0, NO_MOVE, (int8_t) depth, EVALUATING, 0, 1};
+        writes++; // Under the same lock, so that no other claim can create the entry in between
+        replace<strategy>(entries, aged_key(key, age), info);
+        return info;
+    }
+
+    /**
+     * @return The move stored for this position and depth, NO_MOVE if there is none. Doesn't touch the proc count.
+     */
+    [[nodiscard]] Move best_move(uint64_t key, int32_t depth) {
+        ABDADA_TT_Info info{};
+        if (get_if_exists<false>(key, depth, info, false, false)) {
+            return info.move;
+        }
+        return NO_MOVE;
+    }
+
     /**
      *
      * @param key
@@ -281,7 +395,7 @@ public:
         std::lock_guard<Spin_Lock> guard(table[position].entries[0].spin_lock);
         auto & entries = table[position].entries;
         for (auto& entry : entries) { // NOLINT(readability-use-anyofallof)
-            if (entry.key == key) {
+            if (same_position(entry.key, key)) {
                 return true;
             }
         }
@@ -321,6 +435,14 @@ public:
         return (key - depth) & mask; // this is a compile-time constant and gets compiled to either a bit and or an efficient version of this
     }
 
+    /**
+     * Makes every entry one search older, so the next search replaces them before its own. Not thread safe, call this
+     * between searches to keep the TT instead of clearing it.
+     */
+    void new_search() {
+        age = (age + 1) & tt_age_mask;
+    }
+
     /**
      * Imo doesn't make much sense locking this.
      */
@@ -338,7 +460,10 @@ public:
 private:
     uint64_t size;
     uint64_t mask;
-    std::vector<Bucket> table;
+    std::vector<Bucket> heap_table; // Empty if the table lives in a shared segment
+    std::span<Bucket> table;
 
     std::atomic<uint64_t> writes = 0;
+    uint8_t age = 0; // Of the current search, see new_search
+    int32_t defer_depth = DEFER_DEPTH;
 };
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/**
+ * Debug builds replace the global operator new to count the heap allocations of every thread, which lets the benchmark
+ * check that the search threads never allocate. Release builds keep the default allocator and count nothing.
+ */
+#ifdef NDEBUG
+constexpr bool COUNT_ALLOCATIONS = false;
+#else
+constexpr bool COUNT_ALLOCATIONS = true;
+#endif
+
+thread_local uint64_t heap_allocations = 0;
+
+#ifndef NDEBUG
+void* operator new(std::size_t size) {
+    heap_allocations++;
+    if (void* pointer = std::malloc(size == 0 ? 1 : size)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+#endif
+
+/**
+ * Wraps a thread function so that it adds the heap allocations that thread makes to allocations.
+ */
+template<class Function>
+auto counting_allocations(Function function, std::atomic<uint64_t>& allocations) {
+    return [function, &allocations]() mutable {
+        uint64_t before = heap_allocations;
+        function();
+        allocations += heap_allocations - before;
+    };
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "search_result.h"
+#include "search_limits.h"
+
+/**
+ * How a batch spreads its positions over the cores. Each position gets threads_per_position threads, so
+ * total_threads / threads_per_position positions are in flight at a time. Fewer threads per position scale better,
+ * so for a large batch 1 gives the most positions per hour; more only help to finish a small batch sooner. The more
+ * positions are in flight, the smaller each of their TTs.
+ */
+struct Batch_Options {
+    std::size_t total_threads = std::thread::hardware_concurrency();
+    std::size_t threads_per_position = 1;
+    std::size_t hash_size = 1024; // MB for the whole batch, split evenly between the positions in flight
+    Search_Limits limits = Search_Limits::to_depth(10);
+};
+
+struct Batch_Position {
+    uint64_t index = 0; // Line of the position in the input, counting only positions
+    std::string epd; // The first four FEN fields, without the move counters
+    std::string fen;
+    std::string id; // The id opcode of the EPD record, if it has one
+};
+
+/**
+ * The searches call print_table after every iteration, a batch only writes the final result.
+ */
+struct Batch_Result : Search_Result {
+    void print_table(int, int) const {
+    }
+};
+
+/**
+ * Reads the next position from an EPD or FEN file, skipping empty lines and lines starting with #. EPD records only
+ * have the first four FEN fields followed by opcodes; of those we keep the id.
+ */
+inline bool read_position(std::istream& input, Batch_Position& position) {
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream fields(line);
+        std::string field;
+        std::vector<std::string> fen;
+        while (fen.size() < 6 && fields >> field) {
+            fen.push_back(field);
+        }
+        if (fen.empty() || fen[0][0] == '#') {
+            continue;
+        }
+        std::string rest;
+        std::getline(fields, rest);
+        if (fen.size() == 6 && !std::all_of(fen[4].begin(), fen[4].end(), ::isdigit)) { // EPD, fields 5 and 6 are opcodes
+            rest = fen[4] + " " + fen[5] + rest;
+            fen.resize(4);
+        }
+        position.epd = fen[0];
+        for (std::size_t i = 1; i < fen.size() && i < 4; i++) {
+            position.epd += " " + fen[i];
+        }
+        position.fen = position.epd + (fen.size() == 6 ? " " + fen[4] + " " + fen[5] : " 0 1");
+        position.id.clear();
+        if (auto id = rest.find("id \""); id != std::string::npos) {
+            auto end = rest.find('"', id + 4);
+            position.id = rest.substr(id + 4, end == std::string::npos ? std::string::npos : end - id - 4);
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Searches every position of input and writes one EPD record per result to output as soon as it is done, so results
+ * come in the order the positions finish, not the order of the input. Positions get identified by their id opcode, or
+ * by their index if they have none.
+ *
+ * Cores get handed out as they free up: whenever a position finishes, its threads go to the next position right away.
+ * We read a few positions ahead, so once the input runs out we know how many are left to start and split the free
+ * cores between them, which keeps the tail of the batch from running on only a few cores. Positions already in flight
+ * keep their threads though, a search can't grow.
+ *
+ * Each position in flight has its own TT of options.hash_size / max_in_flight MB, at least 1, so the batch as a whole
+ * stays within options.hash_size. The TTs get cleared between positions so that results don't depend on the order the
+ * positions got searched in.
+ */
+template<class Transposition_Table, class Search>
+void run_batch(std::istream& input, std::ostream& output, const Batch_Options& options) {
+    std::size_t total_threads = std::max<std::size_t>(options.total_threads, 1);
+    std::size_t threads_per_position = std::clamp<std::size_t>(options.threads_per_position, 1, total_threads);
+    std::size_t max_in_flight = total_threads / threads_per_position;
+    std::size_t table_size = std::max<std::size_t>(options.hash_size / max_in_flight, 1);
+
+    std::vector<std::unique_ptr<Transposition_Table>> tables;
+    std::vector<std::size_t> free_tables;
+    for (std::size_t i = 0; i < max_in_flight; i++) {
+        tables.push_back(std::make_unique<Transposition_Table>(table_size));
+        free_tables.push_back(i);
+    }
+
+    std::mutex mutex; // Guards everything below, and output
+    std::condition_variable position_done;
+    std::size_t free_cores = total_threads;
+    std::vector<std::thread> running;
+    std::vector<std::thread::id> finished; // Threads that are done and can be joined
+    uint64_t positions = 0, total_nodes = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    auto search_position = [&](Batch_Position position, std::size_t threads, std::size_t table) {
+        Board board;
+        board.applyFen(position.fen);
+        Search search(threads, board, *tables[table]);
+        search.set_seed(position.index);
+        auto position_start = std::chrono::steady_clock::now();
+        Batch_Result result = search.template parallel_search<Batch_Result, true>(options.limits);
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - position_start;
+        tables[table]->clear();
+
+        std::lock_guard<std::mutex> guard(mutex);
+        output << position.epd << " bm " << convertMoveToUci(result.move) << "; ce " << result.eval
+               << "; acd " << result.depth << "; acn " << result.nodes << "; acs " << time.count() << "; c0 \"threads " << threads << "\"; id \""
+               << (position.id.empty() ? std::to_string(position.index) : position.id) << "\";" << std::endl;
+        positions++;
+        total_nodes += result.nodes;
+        free_cores += threads;
+        free_tables.push_back(table);
+        finished.push_back(std::this_thread::get_id());
+        position_done.notify_one();
+    };
+
+    std::deque<Batch_Position> pending;
+    bool input_done = false;
+    uint64_t index = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        while (!input_done && pending.size() < max_in_flight) { // Read ahead so we know when the end is near
+            Batch_Position position;
+            position.index = index++;
+            if (read_position(input, position)) {
+                pending.push_back(std::move(position));
+            } else {
+                input_done = true;
+            }
+        }
+        if (pending.empty()) {
+            break;
+        }
+        position_done.wait(lock, [&]() { return free_cores >= threads_per_position && !free_tables.empty(); });
+        for (auto id : finished) {
+            auto thread = std::find_if(running.begin(), running.end(), [id](auto& t) { return t.get_id() == id; });
+            thread->join(); // Only waits for the few instructions after the thread released the lock
+            running.erase(thread);
+        }
+        finished.clear();
+
+        std::size_t threads = threads_per_position;
+        if (input_done) { // Nothing will come after the pending positions, so they can have all the free cores
+            threads = std::max(threads_per_position, free_cores / pending.size());
+        }
+        free_cores -= threads;
+        std::size_t table = free_tables.back();
+        free_tables.pop_back();
+        running.emplace_back(search_position, std::move(pending.front()), threads, table);
+        pending.pop_front();
+    }
+    position_done.wait(lock, [&]() { return free_cores == total_threads; });
+    lock.unlock();
+    for (auto& thread : running) {
+        thread.join();
+    }
+
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    std::cout << "Batch: " << positions << " positions in " << time.count() << " s, "
+              << (uint64_t) (positions / time.count() * 3600) << " positions per hour, "
+              << (uint64_t) (total_nodes / time.count()) << " nps, " << max_in_flight << " positions in flight with "
+              << threads_per_position << " threads and " << table_size << " MB hash each" << std::endl;
+}
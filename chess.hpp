@@ -2,6 +2,7 @@
 
 #include "chess-library/src/chess.hpp"
 #include "compile_time_constants.h"
+#include "rng.h"
 #include <random>
 
 using namespace Chess;
@@ -134,16 +135,16 @@ Eval_Type Board::eval<Board::Incremental_PST>() {
     return eval;
 }
 
+thread_local uint64_t eval_seed = 0; // Seed of the pseudo random eval, the same in every thread of a search
+thread_local Counter_RNG eval_rng; // Stream of the random eval, every thread has its own
+
 template<>
 Eval_Type Board::eval<Board::Random>() {
-    static std::mt19937 rng(12345);
-    static std::uniform_int_distribution<int16_t> uniform(MIN_EVAL, MAX_EVAL);
-    return uniform(rng);
+    return (Eval_Type) (MIN_EVAL + (int32_t) eval_rng.bounded(MAX_EVAL - MIN_EVAL + 1));
 }
 
-int seed = 0;
 long murmur64(long h) {
-    h += seed;
+    h += eval_seed;
     h ^= h >> 33;
     h *= 0xff51afd7ed558ccdL;
     h ^= h >> 33;
@@ -152,12 +153,47 @@ long murmur64(long h) {
     return h;
 }
 
-void change_seed() {
-    seed++;
+/**
+ * Call this at the start of every search thread. The eval seeds are per thread rather than global, so nothing a search
+ * reads changes under it, and the random eval no longer races on one shared generator.
+ * Streams below 2^32 belong to the random eval, see move_order_rng.
+ */
+void seed_thread(uint64_t seed, uint64_t thread_id) {
+    eval_seed = seed;
+    eval_rng = Counter_RNG(seed, thread_id);
+}
+
+/**
+ * Wraps a thread function so that it seeds the thread first, see seed_thread.
+ */
+template<class Function>
+auto seeded(Function function, uint64_t seed, uint64_t thread_id) {
+    return [function, seed, thread_id]() mutable {
+        seed_thread(seed, thread_id);
+        function();
+    };
+}
+
+/**
+ * The random move order of a thread in one iteration. Every iteration starts a fresh stream, so the move order at a
+ * given depth does not depend on how many numbers the earlier iterations drew. Unless DETERMINISTIC_SEARCH is set,
+ * the seed only matters for the pseudo random eval and the move orders are different in every run.
+ */
+Counter_RNG move_order_rng(uint64_t seed, uint64_t thread_id, int depth) {
+    if constexpr (!DETERMINISTIC_SEARCH) {
+        seed = std::random_device{}();
+    }
+    return {seed, ((uint64_t) depth << 32) + thread_id};
 }
 
-void reset_seed() {
-    seed = 0;
+/**
+ * One step of a Fisher-Yates shuffle: swaps a random one of the moves from index on into index. Doing this for every
+ * index in increasing order shuffles the whole list, and the first k steps already give a random choice of the first k
+ * moves, which is all a node that cuts off after k moves needs.
+ */
+void shuffle_step(Movelist& moves, int index, Counter_RNG& rng) {
+    int random_index = index + (int) rng.bounded(moves.size - index);
+    std::swap(moves[index], moves[random_index]);
 }
 
 /**
@@ -6,4 +6,22 @@ constexpr bool DEBUG_OUTPUTS = false;
 constexpr Eval_Type MIN_EVAL = std::numeric_limits<int16_t>::min() + 1, MAX_EVAL = std::numeric_limits<int16_t>::max();
 constexpr Eval_Type ON_EVALUATION = std::numeric_limits<int16_t>::min();
 constexpr std::int32_t DEFER_DEPTH = 3;
-constexpr bool PRINT_TO_FILE = true;
\ No newline at end of file
+constexpr bool PRINT_TO_FILE = true;
+constexpr bool CUTOFF_PROPAGATION = false; // Stop other ABDADA threads searching a shared node once one finds a cutoff
+constexpr bool WORK_STEALING = false; // Let threads with only deferred moves left search moves other threads deferred
+constexpr bool SUBTREE_SIZES = false; // Store log2 subtree sizes in the TT and use them to order, defer and share moves
+constexpr uint8_t MIN_DEFERRED_SUBTREE = 8; // log2 nodes, smaller known subtrees get searched right away, not deferred
+constexpr uint8_t MIN_SHARED_SUBTREE = 12; // log2 nodes, smaller known subtrees are not published for other threads
+constexpr bool DETERMINISTIC_SEARCH = true; // Derive the random move orders from the search seed, so runs repeat
+constexpr bool LAZY_SHUFFLE = true; // Shuffle each move only when the search gets to it, cutoffs skip the rest
+constexpr std::int32_t SHUFFLE_DEPTH = 1; // Nodes below this depth search their moves in generation order
+constexpr uint64_t STOP_POLL_NODES = 256; // Search threads load the shared stop flag only once per this many nodes
+constexpr int REPORT_INTERVAL_MS = 0; // Print live nodes, nps and best move of the benchmark searches this often, 0 is off
+constexpr bool STAGED_MOVEGEN = false; // Interior nodes play the TT move before generating moves, then captures, then quiets
+constexpr bool TIME_MOVEGEN = false; // Measure the time the search threads spend in move generation, costs two clock reads each
+constexpr bool MOVE_ORDERING = false; // MVV-LVA captures, then killers and history for quiets, else random or generation order
+constexpr bool SEE_PRUNING = false; // The q-search skips captures that lose material by static exchange evaluation
+constexpr bool DELTA_PRUNING = false; // The q-search skips captures whose victim cannot lift the static eval to alpha
+constexpr bool NULL_MOVE_PRUNING = false; // Null window nodes first try passing at reduced depth, and cut off if even that reaches beta
+constexpr bool LATE_MOVE_REDUCTIONS = false; // Null window nodes search late quiet moves shallower, and again at full depth if they reach beta
+constexpr bool FUTILITY_PRUNING = false; // Null window nodes near the leaves skip quiet moves when the static eval is far below beta
\ No newline at end of file
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+constexpr std::size_t searched_lines_per_thread = 64;
+constexpr std::size_t searched_line_size = 8; // Keys per cache line, which is also the probe bound
+
+/**
+ * The set of positions some thread is currently searching, for Simplified ABDADA. Every key hashes to one cache line
+ * and is only ever looked for in that line, so a probe touches a single cache line and needs no lock: threads claim an
+ * empty slot with a compare and swap, and release it by swapping their key back to 0.
+ * If the line of a key is full, the key is not stored at all. The caller then searches the position without other
+ * threads knowing, which can duplicate work, so these overflows are counted instead of silently happening.
+ * The table grows with the number of threads, since every thread has at most a handful of positions per ply in here.
+ */
+class Currently_Searched {
+
+private:
+    struct alignas(64) Line {
+        std::atomic<uint64_t> keys[searched_line_size] = {};
+    };
+
+    std::vector<Line> lines;
+    uint64_t mask;
+
+    [[nodiscard]] static uint64_t key_of(uint64_t hash, int depth) {
+        uint64_t key = hash ^ ((uint64_t) depth << 56); // Same position at a different depth is a different search
+        return key != 0 ? key : 1; // 0 marks an empty slot
+    }
+
+    [[nodiscard]] Line& line_of(uint64_t hash, int depth) {
+        return lines[(hash + depth) & mask];
+    }
+
+    /**
+     * Two threads can both find a key missing from its line and then swap it into two different empty slots. So after
+     * swapping ours in, we look at the line again and back off if another slot holds the key too. Our swap and the other
+     * thread's are ordered with these loads, so at least one of the two threads sees the other and backs off. Rarely
+     * both do, and both defer a position nobody registered, which costs a little time instead of duplicating a search.
+     * @return true if our slot is the only one with the key, else we freed our slot again.
+     */
+    static bool confirm(Line& line, std::atomic<uint64_t>& ours, uint64_t key) {
+        for (auto& slot : line.keys) {
+            if (&slot != &ours && slot.load(std::memory_order_seq_cst) == key) {
+                ours.store(0, std::memory_order_release);
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    enum Claim { CLAIMED, TAKEN, OVERFLOWED };
+
+    explicit Currently_Searched(std::size_t num_threads)
+            : lines(std::bit_ceil(num_threads * searched_lines_per_thread)), mask(lines.size() - 1) {
+    }
+
+    /**
+     * Call this before every iteration; threads that stopped because the iteration was finished don't release their
+     * positions.
+     */
+    void clear() {
+        for (auto& line : lines) {
+            for (auto& key : line.keys) {
+                key.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Registers the calling thread as searching this position, unless another thread already is.
+     * @param failed_swaps Incremented for every compare and swap we lost to another thread.
+     * @return CLAIMED if we registered, TAKEN if another thread searches this position, OVERFLOWED if the line is full.
+     */
+    Claim claim(uint64_t hash, int depth, uint64_t& failed_swaps) {
+        uint64_t key = key_of(hash, depth);
+        Line& line = line_of(hash, depth);
+        for (auto& slot : line.keys) { // Check the whole line first, an earlier slot may have been freed since
+            if (slot.load(std::memory_order_relaxed) == key) {
+                return TAKEN;
+            }
+        }
+        for (auto& slot : line.keys) {
+            uint64_t expected = 0;
+            if (slot.load(std::memory_order_relaxed) != 0) {
+                continue;
+            }
+            if (slot.compare_exchange_strong(expected, key, std::memory_order_seq_cst)) {
+                return confirm(line, slot, key) ? CLAIMED : TAKEN;
+            }
+            failed_swaps++; // Another thread took this slot between our load and our swap
+            if (expected == key) { // It even claimed the same position
+                return TAKEN;
+            }
+        }
+        return OVERFLOWED;
+    }
+
+    /**
+     * Releases a position claimed before. Only call this after claim returned CLAIMED: it frees whichever slot holds the
+     * key, so after TAKEN or OVERFLOWED it could free the claim of another thread.
+     */
+    void release(uint64_t hash, int depth) {
+        uint64_t key = key_of(hash, depth);
+        for (auto& slot : line_of(hash, depth).keys) {
+            uint64_t expected = key;
+            if (slot.compare_exchange_strong(expected, 0, std::memory_order_acq_rel)) {
+                return;
+            }
+        }
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <bit>
+#include "locking_tt.h"
+
+constexpr std::size_t cutoff_table_size = 4096;
+
+/**
+ * A small table of the shared nodes that threads are currently searching. Every thread entering a null window node
+ * above the defer depth registers here; if one of the threads then finds a beta cutoff, it bumps the abort epoch of
+ * that node and raises the abort flag of every other thread inside it. Those threads unwind up to the refuted node and
+ * return the cutoff value from there instead of finishing their now redundant search.
+ * The set of threads inside a node is a 64 bit mask, so threads with an id of 64 or more never get registered and
+ * simply search on as before.
+ */
+class Cutoff_Table {
+
+private:
+    struct alignas(64) Shared_Node {
+        uint64_t key = 0;
+        int32_t depth = 0;
+        Eval_Type beta = 0;
+        Eval_Type cutoff_eval = 0;
+        uint64_t cutoff_nodes = 0;
+        uint64_t searchers = 0; // Bit mask of the threads inside this node
+        std::atomic<uint32_t> epoch = 0;
+        Spin_Lock lock;
+    };
+
+    struct alignas(64) Abort_Flag {
+        std::atomic<bool> requested = false;
+    };
+
+    std::vector<Shared_Node> nodes;
+    std::vector<Abort_Flag> abort_flags;
+
+public:
+    explicit Cutoff_Table(std::size_t num_threads) : nodes(cutoff_table_size), abort_flags(num_threads) {
+    }
+
+    /**
+     * Call this before every iteration; abort flags that were raised while the last iteration finished are stale.
+     */
+    void reset() {
+        for (auto& flag : abort_flags) {
+            flag.requested = false;
+        }
+    }
+
+    [[nodiscard]] bool abort_requested(std::size_t thread_id) const {
+        return abort_flags[thread_id].requested.load(std::memory_order_relaxed);
+    }
+
+    void clear_abort(std::size_t thread_id) {
+        abort_flags[thread_id].requested.store(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return The slot of this node, or -1 if the slot is taken by a different node or the thread can't be registered.
+     * On success epoch contains the epoch of the node at the time of entering.
+     */
+    int enter(uint64_t key, int32_t depth, Eval_Type beta, std::size_t thread_id, uint32_t& epoch) {
+        if (thread_id >= 64) {
+            return -1;
+        }
+        int slot = (int) ((key + depth) & (cutoff_table_size - 1));
+        Shared_Node& node = nodes[slot];
+        std::lock_guard<Spin_Lock> guard(node.lock);
+        if (node.searchers == 0) {
+            node.key = key;
+            node.depth = depth;
+            node.beta = beta;
+        } else if (node.key != key || node.depth != depth || node.beta != beta) {
+            return -1; // Only threads with the same window can share a cutoff, everyone else searches on as before
+        }
+        node.searchers |= 1ULL << thread_id;
+        epoch = node.epoch.load(std::memory_order_relaxed);
+        return slot;
+    }
+
+    void leave(int slot, std::size_t thread_id) {
+        Shared_Node& node = nodes[slot];
+        std::lock_guard<Spin_Lock> guard(node.lock);
+        node.searchers &= ~(1ULL << thread_id);
+    }
+
+    /**
+     * Marks the node as refuted and tells all other threads inside it to stop.
+     * @return The new epoch of the node.
+     */
+    uint32_t cutoff(int slot, std::size_t thread_id, Eval_Type eval, uint64_t nodes_spent) {
+        Shared_Node& node = nodes[slot];
+        std::lock_guard<Spin_Lock> guard(node.lock);
+        node.cutoff_eval = eval;
+        node.cutoff_nodes = nodes_spent;
+        uint64_t others = node.searchers & ~(1ULL << thread_id);
+        while (others != 0) {
+            abort_flags[std::countr_zero(others)].requested.store(true, std::memory_order_relaxed);
+            others &= others - 1;
+        }
+        return node.epoch.fetch_add(1) + 1;
+    }
+
+    [[nodiscard]] bool refuted(int slot, uint32_t epoch) const {
+        return nodes[slot].epoch.load(std::memory_order_relaxed) != epoch;
+    }
+
+    /**
+     * Only meaningful for a refuted node. Every thread that can still cut this node searches it with the same window,
+     * so a later cutoff in this slot overwrites this with an equally valid value.
+     */
+    [[nodiscard]] Eval_Type cutoff_eval(int slot) {
+        std::lock_guard<Spin_Lock> guard(nodes[slot].lock);
+        return nodes[slot].cutoff_eval;
+    }
+
+    [[nodiscard]] uint64_t cutoff_nodes(int slot) {
+        std::lock_guard<Spin_Lock> guard(nodes[slot].lock);
+        return nodes[slot].cutoff_nodes;
+    }
+};
+
+/**
+ * Registers a thread in a shared node for the lifetime of this object. Nothing gets registered if cutoff propagation is
+ * turned off or the caller does not consider the node shared, e.g. because it is below the defer depth.
+ */
+class Shared_Node_Entry {
+
+    Cutoff_Table* table = nullptr;
+    std::size_t thread_id = 0;
+    int slot = -1;
+    uint32_t epoch = 0;
+
+public:
+    Shared_Node_Entry(Cutoff_Table& table, bool shared, uint64_t key, int32_t depth, Eval_Type beta, std::size_t thread_id)
+            : table(&table), thread_id(thread_id) {
+        if (CUTOFF_PROPAGATION && shared) {
+            slot = table.enter(key, depth, beta, thread_id, epoch);
+        }
+    }
+
+    Shared_Node_Entry(const Shared_Node_Entry&) = delete;
+    Shared_Node_Entry& operator=(const Shared_Node_Entry&) = delete;
+
+    ~Shared_Node_Entry() {
+        if (slot >= 0) {
+            table->leave(slot, thread_id);
+            if (refuted()) { // We are the node the abort was meant for, so we consumed it
+                table->clear_abort(thread_id);
+            }
+        }
+    }
+
+    [[nodiscard]] bool refuted() const {
+        return slot >= 0 && table->refuted(slot, epoch);
+    }
+
+    [[nodiscard]] Eval_Type cutoff_eval() const {
+        return table->cutoff_eval(slot);
+    }
+
+    /**
+     * Estimate of the nodes this thread saves by stopping here: the thread that found the cutoff needed cutoff_nodes
+     * for the whole node, and we would likely have needed about as many.
+     */
+    [[nodiscard]] uint64_t nodes_saved(uint64_t nodes_spent) const {
+        uint64_t needed = table->cutoff_nodes(slot);
+        return needed > nodes_spent ? needed - nodes_spent : 0;
+    }
+
+    void cutoff(Eval_Type eval, uint64_t nodes_spent) {
+        if (slot >= 0) {
+            epoch = table->cutoff(slot, thread_id, eval, nodes_spent); // Our own cutoff does not refute us
+        }
+    }
+};
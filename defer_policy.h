@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "compile_time_constants.h"
+
+constexpr int32_t max_defer_depth = 16;
+constexpr uint64_t defer_adapt_interval = 1024; // Shared probes between two adaptations
+constexpr uint64_t defer_min_samples = 64; // Don't adapt on fewer shared probes than this at the current depth
+constexpr double defer_sync_cost = 4; // Estimated cost of sharing a node, i.e. the locking and TT writes, in nodes
+
+/**
+ * Per thread policy deciding from which depth on nodes are shared, i.e. tracked so that other threads defer them.
+ * Sharing a node pays off if the chance that another thread is already searching it, times the size of the subtree we
+ * then don't search twice, exceeds the cost of the synchronization. The policy measures both at its current defer depth
+ * and moves the depth up if sharing does not pay off there, and down if it would pay off one depth lower, assuming the
+ * hit rate is about the same there. The statistics decay on every adaptation so the policy follows the search.
+ * A non-adaptive policy simply shares everything from its fixed depth on.
+ */
+class Defer_Policy {
+
+private:
+    int32_t defer_depth = DEFER_DEPTH;
+    bool adaptive = false;
+    uint64_t probes[max_defer_depth + 1] = {};
+    uint64_t hits[max_defer_depth + 1] = {};
+    uint64_t subtree_nodes[max_defer_depth + 1] = {};
+    uint64_t subtrees[max_defer_depth + 1] = {};
+    uint64_t since_adaptation = 0;
+
+    [[nodiscard]] double hit_rate(int32_t depth) const {
+        return (double) hits[depth] / (double) probes[depth];
+    }
+
+    [[nodiscard]] double subtree_size(int32_t depth) const {
+        return (double) subtree_nodes[depth] / (double) subtrees[depth];
+    }
+
+    void adapt() {
+        since_adaptation = 0;
+        int32_t depth = std::min(defer_depth, max_defer_depth);
+        if (probes[depth] < defer_min_samples || subtrees[depth] == 0) {
+            return;
+        }
+        if (hit_rate(depth) * subtree_size(depth) < defer_sync_cost) {
+            defer_depth = std::min(defer_depth + 1, max_defer_depth);
+        } else if (depth > 1 && subtrees[depth - 1] > 0
+                   && hit_rate(depth) * subtree_size(depth - 1) > 2 * defer_sync_cost) { // Margin against flip-flopping
+            defer_depth--;
+        }
+        for (int32_t i = 0; i <= max_defer_depth; i++) {
+            probes[i] /= 2;
+            hits[i] /= 2;
+            subtree_nodes[i] /= 2;
+            subtrees[i] /= 2;
+        }
+    }
+
+public:
+    void reset(int32_t depth, bool adaptive_depth) {
+        *this = Defer_Policy{};
+        defer_depth = std::clamp(depth, 1, max_defer_depth);
+        adaptive = adaptive_depth;
+    }
+
+    [[nodiscard]] bool shares(int32_t depth) const {
+        return depth >= defer_depth;
+    }
+
+    [[nodiscard]] int32_t depth() const {
+        return defer_depth;
+    }
+
+    /**
+     * Call this for every probe of a shared node that could have been deferred.
+     * @param hit Whether another thread was already searching the node.
+     */
+    void record_probe(int32_t depth, bool hit) {
+        if (!adaptive) {
+            return;
+        }
+        depth = std::min(depth, max_defer_depth);
+        probes[depth]++;
+        hits[depth] += hit;
+        if (++since_adaptation >= defer_adapt_interval) {
+            adapt();
+        }
+    }
+
+    void record_subtree(int32_t depth, uint64_t nodes) {
+        if (!adaptive || depth > max_defer_depth) {
+            return;
+        }
+        subtree_nodes[depth] += nodes;
+        subtrees[depth]++;
+    }
+};
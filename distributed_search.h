@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "search_result.h"
+#include "search_limits.h"
+#include "abdada_tt.h"
+#include "abdada_search.h"
+#include "node_network.h"
+#include "distributed_tt.h"
+
+/**
+ * What node 0 hears from the whole search.
+ */
+struct Distributed_Summary {
+    std::mutex mutex;
+    bool done = false; // Whether some node completed the search, then move, eval and depth are its result
+    Move move = NO_MOVE;
+    Eval_Type eval = 0;
+    int depth = 0;
+    uint64_t nodes = 0; // Of all iterations, summed over all nodes
+    uint64_t messages = 0;
+};
+
+/**
+ * Runs one node of a distributed ABDADA search: threads threads on a Distributed_TT, which talks to the other nodes
+ * through the network. The first node to complete the search tells every other node, which halts its own search. Then
+ * every node sends its counts to node 0, which collects everything in summary.
+ * @param hash_size Of the partition of this node.
+ */
+inline void distributed_abdada_node(Node_Network& network, Board& board, std::size_t threads,
+                                    const Search_Limits& limits, uint64_t hash_size, Distributed_Summary& summary) {
+    Distributed_TT<REPLACE_LAST_ENTRY> tt(network, hash_size);
+    ABDADA_Search<true, REPLACE_LAST_ENTRY, Distributed_TT<REPLACE_LAST_ENTRY>> search(threads, board, tt);
+    search.set_seed(network.get_node());
+    std::atomic<bool> done = false;
+
+    network.start([&](std::size_t peer, const Remote_Message& message) {
+        if (message.type == DONE) {
+            if (!done.exchange(true)) {
+                search.halt();
+            }
+            std::lock_guard<std::mutex> guard(summary.mutex);
+            if (!summary.done) {
+                summary.done = true;
+                summary.move = message.info.move;
+                summary.eval = message.info.eval;
+                summary.depth = message.info.depth;
+            }
+        } else if (message.type == NODE_COUNT || message.type == MESSAGE_COUNT) {
+            std::lock_guard<std::mutex> guard(summary.mutex);
+            (message.type == NODE_COUNT ? summary.nodes : summary.messages) += message.key;
+        } else {
+            tt.handle(peer, message);
+        }
+    });
+    Summed_Result result = search.parallel_search<Summed_Result, true>(limits);
+    if (!done.exchange(true)) { // We completed the search first
+        network.broadcast({DONE, 0, 0, 0, {result.eval, result.move, (int8_t) result.depth, EXACT, 0, 0}});
+        std::lock_guard<std::mutex> guard(summary.mutex);
+        if (!summary.done) {
+            summary.done = true;
+            summary.move = result.move;
+            summary.eval = result.eval;
+            summary.depth = result.depth;
+        }
+    }
+    if (network.get_node() == 0) {
+        std::lock_guard<std::mutex> guard(summary.mutex);
+        summary.nodes += result.total_nodes;
+        summary.messages += network.get_messages_sent();
+    } else {
+        network.send(0, {NODE_COUNT, 0, 0, result.total_nodes, {}});
+        network.send(0, {MESSAGE_COUNT, 0, 0, network.get_messages_sent() + 1, {}}); // Counting this one
+    }
+    std::cout << "node " << network.get_node() << ": " << result.total_nodes << " nodes, " << network.get_messages_sent()
+              << " messages in " << network.get_batches_sent() << " batches, " << tt.get_cold_defers()
+              << " cold defers" << std::endl;
+    network.close_connections(); // Before tt goes away, the receivers use it until then
+}
+
+/**
+ * Searches the start position to depth with ABDADA once with processes * threads threads in this process, and once
+ * distributed over processes processes of threads threads each, which talk over TCP on 127.0.0.1. Both use hash_size
+ * MB of TT in total. Prints both, the speedup of the distributed search, and how many messages it took per node.
+ */
+inline void run_distributed_benchmark(std::size_t processes, std::size_t threads, int depth, uint64_t hash_size) {
+    Board board;
+    board.applyFen(DEFAULT_POS);
+    Search_Limits limits = Search_Limits::to_depth(depth);
+    auto print = [](const std::string& name, double time, uint64_t nodes, Move move, Eval_Type eval, int reached) {
+        std::cout << name << ": depth " << reached << " in " << time << " s, " << nodes << " nodes, "
+                  << (uint64_t) (nodes / time) << " nps, move " << convertMoveToUci(move) << " eval " << eval << std::endl;
+    };
+
+    double threaded_time;
+    {
+        ABDADA_TT<REPLACE_LAST_ENTRY> tt(hash_size);
+        ABDADA_Search<true, REPLACE_LAST_ENTRY> search(processes * threads, board, tt);
+        auto start = std::chrono::steady_clock::now();
+        Summed_Result result = search.parallel_search<Summed_Result, true>(limits);
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+        threaded_time = time.count();
+        print("threads   " + std::to_string(processes * threads), threaded_time, result.total_nodes, result.move,
+              result.eval, result.depth);
+    }
+
+    std::vector<uint16_t> ports;
+    std::vector<int> listeners = Node_Network::listen_loopback(processes, ports);
+    if (listeners.empty()) {
+        return;
+    }
+    uint64_t partition_size = std::max<uint64_t>(hash_size / processes, 1);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pid_t> children;
+    for (std::size_t process = 1; process < processes; process++) {
+        pid_t child = fork(); // No threads run at this point, so the children start in a consistent state
+        if (child == 0) {
+            Node_Network network(process, listeners, ports);
+            Distributed_Summary unused;
+            distributed_abdada_node(network, board, threads, limits, partition_size, unused);
+            _exit(0);
+        } else if (child > 0) {
+            children.push_back(child);
+        }
+    }
+    Distributed_Summary summary;
+    {
+        Node_Network network(0, listeners, ports);
+        if (!network.is_connected() || children.size() + 1 < processes) {
+            std::cerr << "Not every node could join, the counts below miss some" << std::endl;
+        }
+        distributed_abdada_node(network, board, threads, limits, partition_size, summary);
+    }
+    for (pid_t child : children) {
+        waitpid(child, nullptr, 0);
+    }
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    print("processes " + std::to_string(processes) + "x" + std::to_string(threads), time.count(), summary.nodes,
+          summary.move, summary.eval, summary.depth);
+    std::cout << "speedup " << threaded_time / time.count() << ", " << summary.messages << " messages, "
+              << (summary.nodes ? (double) summary.messages / (double) summary.nodes : 0) << " per node searched"
+              << std::endl;
+}
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "compile_time_constants.h"
+#include "transposition_table.h"
+#include "locking_tt.h"
+#include "abdada_tt.h"
+#include "node_network.h"
+#include "chess.hpp"
+
+/**
+ * What this node last heard about the nodes other nodes own: the replies of their owners, plus the claims and stores of
+ * our own threads since. Each slot holds one entry and newer entries simply overwrite older ones.
+ */
+class Remote_Cache {
+
+private:
+    struct Slot {
+        Spin_Lock spin_lock;
+        uint64_t key = 0;
+        ABDADA_TT_Info info = {};
+    };
+
+    std::vector<Slot> slots;
+    uint64_t mask;
+
+    Slot& slot(uint64_t key, int32_t depth) {
+        return slots[(key - depth) & mask]; // Like ABDADA_TT::pos
+    }
+
+public:
+    explicit Remote_Cache(uint64_t size_in_mb) : slots((1 << 20) * std::bit_floor(size_in_mb) / sizeof(Slot)),
+                                                 mask(slots.size() - 1) {
+    }
+
+    bool lookup(uint64_t key, int32_t depth, ABDADA_TT_Info& info) {
+        Slot& entry = slot(key, depth);
+        std::lock_guard<Spin_Lock> guard(entry.spin_lock);
+        if (entry.key == key && entry.info.depth == depth) {
+            info = entry.info;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Overwrites the entry, proc count included, so the owner's view replaces ours.
+     */
+    void update(uint64_t key, int32_t depth, const ABDADA_TT_Info& info) {
+        Slot& entry = slot(key, depth);
+        std::lock_guard<Spin_Lock> guard(entry.spin_lock);
+        entry.key = key;
+        entry.info = info;
+        entry.info.depth = (int8_t) depth;
+    }
+
+    /**
+     * Writes the entry like ABDADA_TT::emplace does, i.e. keeps the proc count, and decrements it if asked to.
+     */
+    void store(uint64_t key, int32_t depth, ABDADA_TT_Info info, bool decrementing) {
+        Slot& entry = slot(key, depth);
+        std::lock_guard<Spin_Lock> guard(entry.spin_lock);
+        if (entry.key == key && entry.info.depth == depth) {
+            info.proc_number = entry.info.proc_number;
+            if (decrementing && info.proc_number > 0) {
+                info.proc_number--;
+            }
+        } else {
+            info.proc_number = 0;
+        }
+        entry.key = key;
+        entry.info = info;
+    }
+
+    /**
+     * Changes the proc count by our own claims and releases, if we have the entry at all.
+     */
+    void adjust(uint64_t key, int32_t depth, int8_t change) {
+        Slot& entry = slot(key, depth);
+        std::lock_guard<Spin_Lock> guard(entry.spin_lock);
+        if (entry.key == key && entry.info.depth == depth && entry.info.proc_number + change >= 0) {
+            entry.info.proc_number += change;
+        }
+    }
+
+    void clear() {
+        for (Slot& entry : slots) {
+            entry.key = 0;
+            entry.info = {};
+        }
+    }
+};
+
+/**
+ * ABDADA across processes: every node (process) owns the shared nodes of the search tree whose keys hash to it, and
+ * keeps their entries, proc counts included, in its local ABDADA_TT. The other nodes reach them through messages:
+ * stores and releases are sent and forgotten, a claim or probe gets answered with the owner's entry into the Remote_Cache
+ * of the asking node, and every lookup answers from that cache right away instead of waiting for the owner.
+ *
+ * Deferring is what hides the latency: if an exclusive probe finds nothing in the cache, we ask the owner and act as if
+ * someone else searched the node, so the move gets deferred and by the time we come back to it, the answer is usually
+ * there. Nodes below the defer depth are not shared anyway and stay in the local TT without any messages, so the
+ * threads of one node search them Lazy SMP like, and the nodes search them independently.
+ *
+ * Our own claims count in the cached proc count too, so that the threads of one node defer to each other, without
+ * waiting for the owner. The owner counts every claim, even one whose entry became exact meanwhile, since the claimer
+ * can't know that and releases every claim it sends, by a RELEASE or a decrementing STORE. So each release matches a
+ * counted claim, and never takes away the claim of another node.
+ */
+template<TT_Strategy strategy>
+class Distributed_TT {
+
+private:
+    Node_Network& network;
+    ABDADA_TT<strategy> local; // Our partition of the shared nodes, and every unshared node we searched ourselves
+    Remote_Cache cache;
+    std::atomic<uint64_t> cold_defers = 0; // Moves deferred because we knew nothing about them yet
+
+    [[nodiscard]] std::size_t owner(uint64_t key) const {
+        return (key >> 48) % network.get_nodes(); // The TTs index buckets by the low bits, so use the high ones here
+    }
+
+    [[nodiscard]] bool remote(uint64_t key, bool shared) const {
+        return shared && owner(key) != network.get_node();
+    }
+
+    void send(Message_Type type, uint64_t key, int32_t depth, const ABDADA_TT_Info& info = {}, uint8_t flag = 0) {
+        network.send(owner(key), {type, flag, (int8_t) depth, key, info});
+    }
+
+public:
+    /**
+     * @param size_in_mb Of the local TT, the cache gets a quarter of that.
+     */
+    Distributed_TT(Node_Network& network, uint64_t size_in_mb) : network(network), local(size_in_mb),
+                                                                 cache(std::max<uint64_t>(size_in_mb / 4, 1)) {
+    }
+
+    /**
+     * Answers what other nodes send about the nodes we own, and keeps what the owners answer us. Call this for each
+     * message of the table's types, from the receiver threads of the network.
+     */
+    void handle(std::size_t peer, const Remote_Message& message) {
+        ABDADA_TT_Info info{};
+        switch (message.type) {
+            case PROBE: {
+                bool found = local.template get_if_exists<false>(message.key, message.depth, info, false, true);
+                network.send(peer, {REPLY, found, message.depth, message.key, info});
+                break;
+            }
+            case CLAIM:
+                info = local.claim(message.key, message.depth);
+                network.send(peer, {REPLY, true, message.depth, message.key, info});
+                break;
+            case STORE:
+                if (message.flag) {
+                    local.template emplace<true>(message.key, message.info, message.depth, true);
+                } else {
+                    local.template emplace<false>(message.key, message.info, message.depth, true);
+                }
+                break;
+            case RELEASE:
+                local.decrement_proc(message.key, message.depth, true);
+                break;
+            case REPLY:
+                if (message.flag) {
+                    cache.update(message.key, message.depth, message.info);
+                } else { // Nobody searched it so far, remember that so we don't keep deferring it
+                    cache.update(message.key, message.depth, {0, NO_MOVE, message.depth, EVALUATING, 0, 0});
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    void set_defer_depth(int32_t depth) {
+        local.set_defer_depth(depth);
+    }
+
+    [[nodiscard]] int32_t get_defer_depth() const {
+        return local.get_defer_depth();
+    }
+
+    [[nodiscard]] uint64_t get_cold_defers() const {
+        return cold_defers;
+    }
+
+    template<bool INCREMENTING>
+    [[nodiscard]] bool get_if_exists(uint64_t key, int32_t depth, ABDADA_TT_Info& info, bool exclusive) {
+        return get_if_exists<INCREMENTING>(key, depth, info, exclusive, depth >= get_defer_depth());
+    }
+
+    /**
+     * Like ABDADA_TT::get_if_exists, but for nodes of other nodes the answer comes from the cache, see the class.
+     */
+    template<bool INCREMENTING>
+    [[nodiscard]] bool get_if_exists(uint64_t key, int32_t depth, ABDADA_TT_Info& info, bool exclusive, bool shared) {
+        if constexpr (!use_tt) {
+            return false;
+        }
+        if (!remote(key, shared)) {
+            return local.template get_if_exists<INCREMENTING>(key, depth, info, exclusive, shared);
+        }
+        bool found = cache.lookup(key, depth, info);
+        if constexpr (INCREMENTING) {
+            if (found ? info.type != EXACT && (info.proc_number == 0 || !exclusive) : !exclusive) { // We will search it
+                send(CLAIM, key, depth);
+                if (found) {
+                    cache.adjust(key, depth, 1);
+                } else {
+                    info = {0, NO_MOVE, (int8_t) depth, EVALUATING, 0, 1};
+                    cache.update(key, depth, info);
+                }
+            } else if (!found) { // Defer it until the owner told us about it
+                send(PROBE, key, depth);
+                cold_defers++;
+                info = {0, NO_MOVE, (int8_t) depth, EVALUATING, 0, 1};
+                return true;
+            }
+        } else if (!found) {
+            send(PROBE, key, depth);
+        }
+        return found;
+    }
+
+    template<bool DECREMENTING>
+    void emplace(uint64_t key, ABDADA_TT_Info value, int32_t depth, bool shared) {
+        if constexpr (!use_tt) {
+            return;
+        }
+        if (!remote(key, shared)) {
+            local.template emplace<DECREMENTING>(key, value, depth, shared);
+            return;
+        }
+        cache.store(key, depth, value, DECREMENTING);
+        send(STORE, key, depth, value, DECREMENTING);
+    }
+
+    template<bool DECREMENTING>
+    void emplace(uint64_t key, ABDADA_TT_Info value, int32_t depth) {
+        emplace<DECREMENTING>(key, value, depth, depth >= get_defer_depth());
+    }
+
+    void decrement_proc(uint64_t key, int32_t depth) {
+        decrement_proc(key, depth, depth >= get_defer_depth());
+    }
+
+    void decrement_proc(uint64_t key, int32_t depth, bool shared) {
+        if (!remote(key, shared)) {
+            local.decrement_proc(key, depth, shared);
+            return;
+        }
+        cache.adjust(key, depth, -1);
+        send(RELEASE, key, depth);
+    }
+
+    /**
+     * @return The move stored for this position and depth as far as we know, NO_MOVE if there is none.
+     */
+    [[nodiscard]] Move best_move(uint64_t key, int32_t depth) {
+        ABDADA_TT_Info info{};
+        if (get_if_exists<false>(key, depth, info, false)) {
+            return info.move;
+        }
+        return NO_MOVE;
+    }
+
+    void print_pv(Board& board, int depth) {
+        Board copy(board);
+        while (depth > 0) {
+            Move move = best_move(copy.hashKey, depth);
+            if (move == NO_MOVE) {
+                break;
+            }
+            std::cout << convertMoveToUci(move) << " ";
+            copy.makeMove(move);
+            depth--;
+        }
+        std::cout << std::endl;
+    }
+
+    void print_size() const {
+        local.print_size();
+        std::cout << "Cold defers: " << cold_defers << std::endl;
+    }
+
+    [[nodiscard]] int hashfull() const {
+        return local.hashfull();
+    }
+
+    /**
+     * Only ages our own partition, every node has to do this itself.
+     */
+    void new_search() {
+        local.new_search();
+        cache.clear();
+    }
+
+    void clear() {
+        local.clear();
+        cache.clear();
+        cold_defers = 0;
+    }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "chess.hpp"
+
+struct Search_Progress {
+    double time = 0; // Seconds since the search started
+    uint64_t nodes = 0;
+    double nps = 0;
+    int depth = 0; // The iteration currently being searched
+    Move best_move = NO_MOVE; // Result of the last completed iteration
+    Eval_Type eval = 0;
+};
+
+inline void print_progress(const Search_Progress& progress) {
+    std::cout << "depth " << progress.depth << " nodes " << progress.nodes << " nps " << (uint64_t) progress.nps
+              << " time " << progress.time << " move " << convertMoveToUci(progress.best_move) << " eval "
+              << progress.eval << std::endl;
+}
+
+/**
+ * Node counts of a running search that another thread can read. Each search thread owns one padded counter and only
+ * stores its node count there when it polls the stop signal anyway, see Stop_Poll, so the hot path gets no new atomics
+ * and the counts lag by at most STOP_POLL_NODES per thread.
+ */
+class Live_Stats {
+
+private:
+    using Time_Point = std::chrono::high_resolution_clock::time_point;
+
+    struct alignas(64) Counter {
+        std::atomic<uint64_t> nodes = 0;
+    };
+
+    std::vector<Counter> counters;
+    std::atomic<uint64_t> completed_nodes = 0; // Nodes of all completed iterations
+    std::atomic<int> depth = 0;
+    std::atomic<Move> best_move = NO_MOVE;
+    std::atomic<Eval_Type> eval = 0;
+    Time_Point start;
+
+public:
+    explicit Live_Stats(std::size_t num_threads) : counters(num_threads) {
+    }
+
+    std::atomic<uint64_t>& thread_nodes(std::size_t thread) {
+        return counters[thread].nodes;
+    }
+
+    /**
+     * Call these three between iterations, while no search thread runs.
+     */
+    void start_search() {
+        completed_nodes = 0;
+        depth = 0;
+        best_move = NO_MOVE;
+        eval = 0;
+        start = std::chrono::high_resolution_clock::now();
+    }
+
+    void start_iteration(int iteration_depth) {
+        for (auto& counter : counters) {
+            counter.nodes.store(0, std::memory_order_relaxed);
+        }
+        depth = iteration_depth;
+    }
+
+    /**
+     * @param nodes The exact node count of the iteration, which replaces the sampled counts.
+     */
+    void finish_iteration(uint64_t nodes, Move move, Eval_Type iteration_eval) {
+        completed_nodes += nodes;
+        for (auto& counter : counters) {
+            counter.nodes.store(0, std::memory_order_relaxed);
+        }
+        best_move = move;
+        eval = iteration_eval;
+    }
+
+    [[nodiscard]] Search_Progress sample() const {
+        Search_Progress progress;
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+        progress.time = elapsed.count();
+        progress.nodes = completed_nodes.load(std::memory_order_relaxed);
+        for (auto& counter : counters) {
+            progress.nodes += counter.nodes.load(std::memory_order_relaxed);
+        }
+        progress.nps = progress.time > 0 ? (double) progress.nodes / progress.time : 0;
+        progress.depth = depth.load(std::memory_order_relaxed);
+        progress.best_move = best_move.load(std::memory_order_relaxed);
+        progress.eval = eval.load(std::memory_order_relaxed);
+        return progress;
+    }
+};
+
+/**
+ * Samples the Live_Stats of a search every interval on a thread of its own and hands the result to report, until it is
+ * destroyed.
+ */
+class Progress_Reporter {
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake_up;
+    bool stopping = false;
+    std::thread thread;
+
+public:
+    Progress_Reporter(const Live_Stats& stats, std::chrono::milliseconds interval,
+                      std::function<void(const Search_Progress&)> report) {
+        thread = std::thread([this, &stats, interval, report]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!wake_up.wait_for(lock, interval, [this]() { return stopping; })) {
+                report(stats.sample());
+            }
+        });
+    }
+
+    Progress_Reporter(const Progress_Reporter&) = delete;
+    Progress_Reporter& operator=(const Progress_Reporter&) = delete;
+
+    ~Progress_Reporter() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        wake_up.notify_one();
+        thread.join();
+    }
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+/**
+ * Measures how evenly the work of one iteration is spread over the threads: the ratio of the most nodes any thread
+ * searched to the average, and the total time threads spent waiting for the iteration to end after they were done.
+ */
+class Load_Balance {
+
+private:
+    using Time_Point = std::chrono::high_resolution_clock::time_point;
+
+    std::vector<Time_Point> finish_times;
+    std::vector<uint64_t> thread_nodes;
+
+public:
+    explicit Load_Balance(std::size_t num_threads) : finish_times(num_threads), thread_nodes(num_threads) {
+    }
+
+    /**
+     * Wraps a thread function so that it records when that thread is done.
+     */
+    template<class Function>
+    auto timed(Function function, std::size_t thread) {
+        return [this, function, thread]() mutable {
+            function();
+            finish_times[thread] = std::chrono::high_resolution_clock::now();
+        };
+    }
+
+    void set_nodes(std::size_t thread, uint64_t nodes) {
+        thread_nodes[thread] = nodes;
+    }
+
+    [[nodiscard]] double imbalance() const {
+        uint64_t total = 0;
+        for (uint64_t nodes : thread_nodes) {
+            total += nodes;
+        }
+        if (total == 0) {
+            return 1;
+        }
+        double average = (double) total / (double) thread_nodes.size();
+        return (double) *std::max_element(thread_nodes.begin(), thread_nodes.end()) / average;
+    }
+
+    /**
+     * @param end The time the iteration ended, i.e. all threads were joined.
+     * @return The summed idle time of all threads in seconds.
+     */
+    [[nodiscard]] double idle_time(Time_Point end) const {
+        double idle = 0;
+        for (auto finish_time : finish_times) {
+            std::chrono::duration<double> waited = end - finish_time;
+            idle += waited.count();
+        }
+        return idle;
+    }
+
+    /**
+     * @param stop_time When the iteration got decided, i.e. the thread finishing it told the others to stop.
+     * @return Seconds from then until the last thread was done.
+     */
+    [[nodiscard]] double stop_latency(Time_Point stop_time) const {
+        double latency = 0;
+        for (auto finish_time : finish_times) {
+            std::chrono::duration<double> stopping = finish_time - stop_time;
+            latency = std::max(latency, stopping.count());
+        }
+        return latency;
+    }
+};
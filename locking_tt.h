@@ -3,9 +3,12 @@
 #include <cstdint>
 #include <iostream>
 #include <vector>
+#include <span>
+#include <new>
 #include <bit>
 #include "compile_time_constants.h"
 #include "transposition_table.h"
+#include "shared_memory.h"
 #include "chess.hpp"
 
 struct Spin_Lock {
@@ -27,11 +30,12 @@ struct Spin_Lock {
     }
 };
 
-struct Locked_TT_Info {
+struct __attribute__((packed)) Locked_TT_Info { // Packed so that entries stay 16 bytes, i.e. 4 per cache line
     Eval_Type eval;
     Chess::Move move;
     int8_t depth;
     Bound_Type type;
+    uint8_t subtree_size; // log2 of the nodes the last search of this entry took, 0 if unknown, see subtree_size_log
 };
 
 template<TT_Strategy strategy>
@@ -45,10 +49,15 @@ private:
 
         /**
          * We don't lock anything here, it is the users responsibility to make sure the surrounding structs are locked.
-         * @param other
-         * @return
+         * @param other_key The stored key of other, which carries its age.
+         * @param age The age of the current search, which both entries are ranked against.
+         * @return true if this entry should rather be replaced than other.
          */
-        bool operator<(Locked_TT_Info& other) const {
+        bool worse_than(uint64_t other_key, const Locked_TT_Info& other, uint8_t age) const {
+            uint64_t our_age = searches_ago(key, age), other_age = searches_ago(other_key, age);
+            if (our_age != other_age) { // Entries of earlier searches go first, however deep they are
+                return our_age > other_age;
+            }
             if (value.type == EXACT && other.type != EXACT) {
                 return false;
             } else if (value.type != EXACT && other.type == EXACT) {
@@ -62,9 +71,21 @@ private:
         Entry entries[entries_per_bucket];
     };
 
+    static_assert(sizeof(Entry) == 16, "Entries have to stay 16 bytes so that a bucket fills exactly one cache line");
+
 public:
     explicit Locking_TT(uint64_t size_in_mb = 8192) :
-                size((1 << 20) * std::bit_floor(size_in_mb) / sizeof(Bucket)), mask(size - 1), table(size) {
+                size((1 << 20) * std::bit_floor(size_in_mb) / sizeof(Bucket)), mask(size - 1), heap_table(size),
+                table(heap_table) {
+    }
+
+    /**
+     * Places the table in a shared segment instead of the heap, so that several processes can search on it. A new
+     * segment is all zeros, which already is an empty table.
+     */
+    explicit Locking_TT(Shared_Segment& segment) :
+                size(std::bit_floor(segment.table_bytes() / sizeof(Bucket))), mask(size - 1),
+                table(std::launder(static_cast<Bucket*>(segment.table_memory())), size) {
     }
 
     /**
@@ -83,7 +104,22 @@ public:
             }
         }
         std::cout << "Table elements: " << num_elements << ", exact entries: " << exact_entries << ", total writes: "
-                  << writes << " bucket count " << table.size() << ", bucket capacity: " << table.capacity() << std::endl;
+                  << writes << " bucket count " << table.size() << ", bucket capacity: " << heap_table.capacity() << std::endl;
+    }
+
+    /**
+     * Permille of the first 1000 entries that the current search wrote or used, which is how UCI reports hashfull.
+     * Reads without locking, it is only an estimate anyway.
+     */
+    [[nodiscard]] int hashfull() const {
+        uint64_t used = 0, sampled = 0;
+        for (std::size_t i = 0; i < table.size() && sampled < 1000; i++) {
+            for (auto & entry : table[i].entries) {
+                used += entry.key != 0 && searches_ago(entry.key, age) == 0;
+                sampled++;
+            }
+        }
+        return sampled == 0 ? 0 : (int) (used * 1000 / sampled);
     }
 
     /**
@@ -114,7 +150,7 @@ public:
     void replace<TWO_TWO_SPLIT>(Entry entries[entries_per_bucket], uint64_t key, Locked_TT_Info value) {
         for (int i = 0; i < 4; i++) {
             auto & entry = entries[i];
-            if (entry < value) { // last slot is always replace
+            if (entry.worse_than(key, value, age)) { // last slot is always replace
                 std::swap(entry.value, value);
                 std::swap(entry.key, key);
             }
@@ -130,7 +166,7 @@ public:
     void replace<REPLACE_LAST_ENTRY>(Entry entries[entries_per_bucket], uint64_t key, Locked_TT_Info value) {
         for (int i = 0; i < 4; i++) {
             auto & entry = entries[i];
-            if (entry < value || i == 3) { // last slot is always replace
+            if (entry.worse_than(key, value, age) || i == 3) { // last slot is always replace
                 std::swap(entry.value, value);
                 std::swap(entry.key, key);
             }
@@ -141,7 +177,7 @@ public:
     void replace<DEPTH_FIRST>(Entry entries[entries_per_bucket], uint64_t key, Locked_TT_Info value) {
         for (int i = 0; i < 4; i++) {
             auto & entry = entries[i];
-            if (entry < value) {
+            if (entry.worse_than(key, value, age)) {
                 std::swap(entry.value, value);
                 std::swap(entry.key, key);
             }
@@ -163,15 +199,16 @@ public:
         std::lock_guard<Spin_Lock> guard(spin_lock);
         auto & entries = table[position].entries;
         for (auto & entry : entries) { // Check if the entry already exists
-            if (entry.key == key) {
+            if (same_position(entry.key, key)) {
                 assert(entry.value.depth == depth);
                 assert(value.depth == depth);
+                entry.key = aged_key(key, age);
                 entry.value = value;
                 return;
             }
         }
         writes++; // Entry does not exist yet so we create it
-        replace<strategy>(entries, key, value); // Try to replace an existing (possibly empty) entry.
+        replace<strategy>(entries, aged_key(key, age), value); // Try to replace an existing (possibly empty) entry.
     }
 
     /**
@@ -182,7 +219,7 @@ public:
         std::lock_guard<Spin_Lock> guard(table[position].entries[0].spin_lock);
         auto & entries = table[position].entries;
         for (auto& entry : entries) {
-            if (entry.key == key) {
+            if (same_position(entry.key, key)) {
                 return entry.value;
             }
         }
@@ -201,7 +238,8 @@ public:
         std::lock_guard<Spin_Lock> guard(spin_lock);
         auto & entries = table[position].entries;
         for (auto& entry : entries) {
-            if (entry.key == key) {
+            if (same_position(entry.key, key)) {
+                entry.key = aged_key(key, age); // The current search still uses it
                 info = entry.value;
                 return true;
             }
@@ -209,6 +247,17 @@ public:
         return false;
     }
 
+    /**
+     * @return The move stored for this position and depth, NO_MOVE if there is none.
+     */
+    [[nodiscard]] Move best_move(uint64_t key, int32_t depth) {
+        Locked_TT_Info info{};
+        if (get_if_exists(key, depth, info)) {
+            return info.move;
+        }
+        return NO_MOVE;
+    }
+
     [[nodiscard]] bool contains(uint64_t key, int32_t depth) {
         if constexpr (!use_tt) {
             return false;
@@ -217,7 +266,7 @@ public:
         std::lock_guard<Spin_Lock> guard(table[position].entries[0].spin_lock);
         auto & entries = table[position].entries;
         for (auto& entry : entries) { // NOLINT(readability-use-anyofallof)
-            if (entry.key == key) {
+            if (same_position(entry.key, key)) {
                 return true;
             }
         }
@@ -257,6 +306,14 @@ public:
         return (key - depth) & mask; // this is a compile-time constant and gets compiled to either a bit and or an efficient version of this
     }
 
+    /**
+     * Makes every entry one search older, so the next search replaces them before its own. Not thread safe, call this
+     * between searches to keep the TT instead of clearing it.
+     */
+    void new_search() {
+        age = (age + 1) & tt_age_mask;
+    }
+
     /**
      * Imo doesn't make much sense locking this.
      */
@@ -274,7 +331,9 @@ public:
 private:
     uint64_t size;
     uint64_t mask;
-    std::vector<Bucket> table;
+    std::vector<Bucket> heap_table; // Empty if the table lives in a shared segment
+    std::span<Bucket> table;
 
     std::atomic<uint64_t> writes = 0;
+    uint8_t age = 0; // Of the current search, see new_search
 };
@@ -1,113 +1,154 @@
 #include <iostream>
 #include <fstream>
 #include "perft.h"
+#include "search_result.h"
 #include "sequential_search.h"
 #include "simple_concurrent_search.h"
 #include "abdada_tt.h"
 #include "abdada_search.h"
 #include "simplified_abdada.h"
-
-std::ofstream out;
-
-template <class T>
-void print(const T& t, size_t w)
-{
-    out.width(w);
-    out  << t << " " << std::flush;
-    std::cout.width(w);
-    std::cout << t << " " << std::flush;
-}
-
-void print_headline()
-{
-    print("it", 3);
-    print("num_thr", 7);
-    print("ply", 4);
-    print("time" , 11);
-    print("nps", 9);
-    print("eval", 5);
-    print("nodes", 15);
-    print("move", 5);
-    out       << std::endl;
-    std::cout << std::endl;
-}
-
-struct Search_Result {
-    uint64_t nodes = 0;
-    double duration = 0;
-    Move move = Chess::NO_MOVE;
-    Eval_Type eval = 0;
-    uint16_t depth = 0;
-
-    void print_human_readable() const {
-        std::cout << "Depth " << depth << ": " << convertMoveToUci(move) << " eval " << eval << " nodes " << nodes
-                  << " time " << duration << " nps " << (nodes / duration) << std::endl;
-    }
-
-    void print_table(int iteration, int num_threads) const {
-        if constexpr (PRINT_TO_FILE) {
-            print_for_file(iteration, num_threads);
-        } else {
-            std::cout << iteration << "\t" << depth << "\t" << duration << "\t" << (nodes / duration) << "\t" << eval
-                      << "\t" << nodes << "\t" << convertMoveToUci(move) << std::endl;
-        }
-    }
-
-    void print_for_file(int iteration, int num_threads) const {
-        print(iteration, 3);
-        print(num_threads, 7);
-        print(depth, 4);
-        print(duration, 11);
-        print((std::size_t) (nodes / duration), 9);
-        print(eval, 5);
-        print(nodes, 15);
-        print(convertMoveToUci(move), 5);
-        out << std::endl;
-        std::cout << std::endl;
-    }
-};
-
-template<class Transposition_Table, class Search>
-void run_tests(Board& board, std::size_t hash_size, std::size_t max_threads, int depth_limit, int number_of_iterations) {
+#include "mcts_search.h"
+#include "uci.h"
+#include "batch.h"
+#include "server.h"
+#include "selfplay.h"
+#include "shared_search.h"
+#include "distributed_search.h"
+#include "selective_bench.h"
+
+template<class Transposition_Table, class Search, bool Cooperative_Root>
+void run_tests(Board& board, std::size_t hash_size, std::size_t max_threads, int depth_limit, int number_of_iterations,
+               int switch_depth, bool adaptive_defer) {
     Transposition_Table tt(hash_size);
-    reset_seed();
+    if constexpr (requires { tt.set_defer_depth(switch_depth); }) { // Only the ABDADA TT knows a switch depth
+        tt.set_defer_depth(switch_depth);
+    }
     for (int iteration = 0; iteration < number_of_iterations; iteration++) {
         for (std::size_t num_threads = 1; num_threads <= max_threads; num_threads++) {
             Search search(num_threads, board, tt);
+            if constexpr (requires { search.set_defer_policy(switch_depth, adaptive_defer); }) {
+                search.set_defer_policy(switch_depth, adaptive_defer);
+            }
+            if constexpr (REPORT_INTERVAL_MS > 0 && requires { search.set_reporting(std::chrono::milliseconds(1)); }) {
+                search.set_reporting(std::chrono::milliseconds(REPORT_INTERVAL_MS));
+            }
+            search.set_seed(iteration); // Each iteration has its own pseudo random eval and move orders
             int up_to_depth = depth_limit;
-            search.template parallel_search<Search_Result, true>(up_to_depth, iteration);
+            search.template parallel_search<Search_Result, true, Cooperative_Root>(up_to_depth, iteration);
             tt.clear();
         }
-        change_seed();
     }
 }
 
-enum Algo { LAZY, ABDADA, SIMPLE_ABDADA };
+enum Algo { LAZY, ABDADA, SIMPLE_ABDADA, MCTS };
+
+template<bool Cooperative_Root>
+void run_algorithm(Board& board, int hash_size, Algo algo, std::size_t max_threads, int depth, int iterations,
+                   int switch_depth, bool adaptive_defer) {
+    if (algo == LAZY) {
+        run_tests<Locking_TT<REPLACE_LAST_ENTRY>, Lazy_SMP<true, REPLACE_LAST_ENTRY>, Cooperative_Root>(board, hash_size,
+                                                 max_threads, depth, iterations, switch_depth, adaptive_defer);
+    } else if (algo == ABDADA) {
+        run_tests<ABDADA_TT<REPLACE_LAST_ENTRY>, ABDADA_Search<true, REPLACE_LAST_ENTRY>, Cooperative_Root>(board, hash_size,
+                                                 max_threads, depth, iterations, switch_depth, adaptive_defer);
+    } else if (algo == SIMPLE_ABDADA) {
+        run_tests<Locking_TT<REPLACE_LAST_ENTRY>, Simplified_ABDADA_Search<true, REPLACE_LAST_ENTRY>, Cooperative_Root>(board,
+                                                 hash_size, max_threads, depth, iterations, switch_depth, adaptive_defer);
+    } else if (algo == MCTS) { // The pool takes the place of the TT, depth is the number of playout doublings
+        run_tests<MCTS_Pool, MCTS_Search, Cooperative_Root>(board, hash_size, max_threads, depth, iterations, switch_depth,
+                                                            adaptive_defer);
+    }
+}
 
-void setup_tests(int position, int hash_size, Algo algo, std::size_t max_threads, int depth, int iterations) {
-    static std::string algos[3] = { "lazy", "abdada", "simple-abdada" };
+/**
+ * @param cooperative_root If true, the threads split the root moves instead of searching them independently. The
+ * output file then gets a "_coop" suffix so the search overhead can be compared against the independent root search.
+ * @param switch_depth Depth from which on the ABDADA variants defer nodes, below it the threads search Lazy SMP style.
+ * Ignored by Lazy SMP. If it differs from DEFER_DEPTH, the output file gets a "_switch" suffix with the depth.
+ * @param adaptive_defer If true, switch_depth is only the starting point and every thread adapts its defer depth to
+ * the contention it observes, see Defer_Policy. The output file then gets an "_adaptive" suffix.
+ * Builds with any of the selective search toggles, see selective.h, add a "_selective" suffix, so their files sit next to
+ * those of the fixed depth build instead of overwriting them. Likewise "_staged" for STAGED_MOVEGEN, "_ordered"
+ * for MOVE_ORDERING, "_see" and "_delta" for the q-search pruning of see.h,
+ * "_cutoff" for CUTOFF_PROPAGATION, "_steal" for WORK_STEALING and "_subtree" for SUBTREE_SIZES.
+ */
+void setup_tests(int position, int hash_size, Algo algo, std::size_t max_threads, int depth, int iterations,
+                 bool cooperative_root = false, int switch_depth = DEFER_DEPTH, bool adaptive_defer = false) {
+    static std::string algos[4] = { "lazy", "abdada", "simple-abdada", "mcts" };
     static std::string positions[4] = { "", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
                                         "r1bq1rk1/1pp2pbn/3p2p1/p1nPp1Pp/2P1P2P/2N1BP2/PP2B3/R2QK1NR w KQ - 1 12",
                                         "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -"};
     Board board;
     board.applyFen(positions[position]);
 
-    std::string file_name = "./pos" + std::to_string(position) + "_" + std::to_string(hash_size) + "_" + algos[algo] +  "_d" + std::to_string(depth) + ".txt";
+    std::string file_name = "./pos" + std::to_string(position) + "_" + std::to_string(hash_size) + "_" + algos[algo] +  "_d"
+                            + std::to_string(depth) + (cooperative_root ? "_coop" : "")
+                            + (switch_depth != DEFER_DEPTH ? "_switch" + std::to_string(switch_depth) : "")
+                            + (adaptive_defer ? "_adaptive" : "") + (STAGED_MOVEGEN ? "_staged" : "")
+                            + (MOVE_ORDERING ? "_ordered" : "")
+                            + (SEE_PRUNING ? "_see" : "") + (DELTA_PRUNING ? "_delta" : "") + (SELECTIVE_SEARCH ? "_selective" : "")
+                            + (CUTOFF_PROPAGATION ? "_cutoff" : "") + (WORK_STEALING ? "_steal" : "")
+                            + (SUBTREE_SIZES ? "_subtree" : "") + ".txt";
     out = std::ofstream(file_name);
     print_headline();
-    if (algo == LAZY) {
-        run_tests<Locking_TT<REPLACE_LAST_ENTRY>, Lazy_SMP<true, REPLACE_LAST_ENTRY>>(board, hash_size, max_threads,
-                                                                                      depth, iterations);
-    } else if (algo == ABDADA) {
-        run_tests<ABDADA_TT<REPLACE_LAST_ENTRY>, ABDADA_Search<true, REPLACE_LAST_ENTRY>>(board, hash_size, max_threads,
-                                                                                      depth, iterations);
-    } else if (algo == SIMPLE_ABDADA) {
-        run_tests<Locking_TT<REPLACE_LAST_ENTRY>, Simplified_ABDADA_Search<true, REPLACE_LAST_ENTRY>>(board, hash_size, max_threads,
-                                                                                          depth, iterations);
+    if (cooperative_root) {
+        run_algorithm<true>(board, hash_size, algo, max_threads, depth, iterations, switch_depth, adaptive_defer);
+    } else {
+        run_algorithm<false>(board, hash_size, algo, max_threads, depth, iterations, switch_depth, adaptive_defer);
     }
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "uci") { // Play through a GUI instead of running the benchmark
+        uci_loop(std::cin);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "server") { // server [unix socket path], without a path it serves stdin
+        if (argc > 2) {
+            run_server(std::thread::hardware_concurrency(), server_default_hash, argv[2]);
+        } else {
+            run_server(std::thread::hardware_concurrency(), server_default_hash);
+        }
+        return 0;
+    }
+    if (argc > 5 && std::string(argv[1]) == "shm-bench") { // shm-bench <processes> <threads each> <depth> <hash>
+        run_shared_benchmark(std::stoul(argv[2]), std::stoul(argv[3]), std::stoi(argv[4]), std::stoull(argv[5]));
+        return 0;
+    }
+    if (argc > 5 && std::string(argv[1]) == "dist-bench") { // dist-bench <processes> <threads each> <depth> <hash>
+        run_distributed_benchmark(std::stoul(argv[2]), std::stoul(argv[3]), std::stoi(argv[4]), std::stoull(argv[5]));
+        return 0;
+    }
+    if (argc > 4 && std::string(argv[1]) == "scaling-bench") { // scaling-bench <threads> <depth> <hash>
+        run_selective_benchmark(std::stoul(argv[2]), std::stoi(argv[3]), std::stoull(argv[4]));
+        return 0;
+    }
+    if (argc > 4 && std::string(argv[1]) == "shm-search") { // shm-search <name> <threads> <depth> [hash to create]
+        run_shared_search(argv[2], std::stoul(argv[3]), std::stoi(argv[4]), argc > 5 ? std::stoull(argv[5]) : 0);
+        return 0;
+    }
+    if (argc > 4 && std::string(argv[1]) == "selfplay") { // selfplay <openings file> <player a> <player b>
+        std::ifstream openings(argv[2]);
+        run_match(openings, Player_Config::parse(argv[3]), Player_Config::parse(argv[4]));
+        return 0;
+    }
+    if (argc > 3 && std::string(argv[1]) == "batch") { // batch <epd file> <result file> [depth] [threads per position] [total hash]
+        Batch_Options options;
+        if (argc > 4) {
+            options.limits = Search_Limits::to_depth(std::stoi(argv[4]));
+        }
+        if (argc > 5) {
+            options.threads_per_position = std::stoul(argv[5]);
+        }
+        if (argc > 6) {
+            options.hash_size = std::stoull(argv[6]);
+        }
+        std::ifstream input(argv[2]);
+        std::ofstream output(argv[3]);
+        run_batch<ABDADA_TT<REPLACE_LAST_ENTRY>, ABDADA_Search<true, REPLACE_LAST_ENTRY>>(input, output, options);
+        return 0;
+    }
+
     int depth = 10;
     std::size_t max_threads = std::thread::hardware_concurrency();
     int hash_size = 16384;
@@ -141,5 +182,31 @@ int main() {
     setup_tests(position, hash_size, SIMPLE_ABDADA, max_threads, depth, iterations);
     setup_tests(position, hash_size, LAZY, max_threads, depth, iterations);
 
+    position = 1; // Cooperative root splitting, compare against the independent root runs of position 1 above
+    depth = 10;
+    hash_size = 16384;
+    setup_tests(position, hash_size, ABDADA, max_threads, depth, iterations, true);
+    setup_tests(position, hash_size, SIMPLE_ABDADA, max_threads, depth, iterations, true);
+    setup_tests(position, hash_size, LAZY, max_threads, depth, iterations, true);
+
+    for (int switch_depth = 2; switch_depth <= 6; switch_depth++) { // Hybrid ABDADA above, Lazy SMP below the switch
+        if (switch_depth != DEFER_DEPTH) { // That one is the plain ABDADA run above
+            setup_tests(position, hash_size, ABDADA, max_threads, depth, iterations, false, switch_depth);
+        }
+    }
+
+    for (Algo algo : { ABDADA, SIMPLE_ABDADA }) { // Adaptive defer depth against the fixed depths 1, 2 and 3 (above)
+        setup_tests(position, hash_size, algo, max_threads, depth, iterations, false, 1);
+        if (algo == SIMPLE_ABDADA) { // ABDADA with switch depth 2 already ran in the loop above
+            setup_tests(position, hash_size, algo, max_threads, depth, iterations, false, 2);
+        }
+        setup_tests(position, hash_size, algo, max_threads, depth, iterations, false, DEFER_DEPTH, true);
+    }
+
+    depth = 14; // MCTS scaling; 64 * 2^13 playouts in the last step, with a 1 GB node pool
+    hash_size = 1024;
+    setup_tests(1, hash_size, MCTS, max_threads, depth, iterations);
+    setup_tests(2, hash_size, MCTS, max_threads, depth, iterations);
+
     return 0;
 }
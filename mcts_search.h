@@ -0,0 +1,313 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <functional>
+#include <limits>
+#include <vector>
+#include <bit>
+#include "compile_time_constants.h"
+#include "chess.hpp"
+#include "load_balance.h"
+#include "alloc_counter.h"
+
+constexpr uint64_t mcts_base_playouts = 64; // Playouts of the first step, every further step doubles them
+constexpr uint32_t mcts_expand_visits = 1; // A leaf gets expanded on the visit after this many visits
+constexpr uint32_t mcts_virtual_loss = 3; // Every thread currently below a node counts as this many lost playouts
+constexpr double mcts_exploration = 1.4;
+constexpr double mcts_eval_scale = 400; // Eval difference that turns a 50% win probability into about 73%
+constexpr double mcts_value_scale = 1000; // Values are summed as integers in thousandths of a win
+
+enum MCTS_Node_State : uint8_t {
+    UNEXPANDED, EXPANDING, EXPANDED
+};
+
+/**
+ * All counters are atomics so that threads can update nodes without locking. The value is the sum of the playout
+ * results from the point of view of the side that made the move leading into this node.
+ */
+struct MCTS_Node {
+    std::atomic<uint32_t> visits = 0;
+    std::atomic<uint32_t> virtual_loss = 0; // Number of threads currently searching below this node
+    std::atomic<int64_t> value = 0;
+    std::atomic<uint32_t> first_child = 0;
+    std::atomic<uint16_t> num_children = 0;
+    std::atomic<MCTS_Node_State> state = UNEXPANDED;
+    Move move = NO_MOVE;
+
+    void reset() {
+        visits.store(0, std::memory_order_relaxed);
+        virtual_loss.store(0, std::memory_order_relaxed);
+        value.store(0, std::memory_order_relaxed);
+        first_child.store(0, std::memory_order_relaxed);
+        num_children.store(0, std::memory_order_relaxed);
+        state.store(UNEXPANDED, std::memory_order_relaxed);
+        move = NO_MOVE;
+    }
+};
+
+/**
+ * Preallocated node storage for the MCTS tree. Allocation is a single fetch_add, the children of a node are allocated
+ * in one contiguous block. Once the pool is full, allocations fail and the tree simply stops growing.
+ * Takes the place of the TT in the benchmark, so it is sized in MB the same way.
+ */
+class MCTS_Pool {
+
+private:
+    std::vector<MCTS_Node> nodes;
+    std::atomic<uint64_t> used = 0;
+
+public:
+    static constexpr uint32_t NO_NODE = std::numeric_limits<uint32_t>::max();
+
+    explicit MCTS_Pool(uint64_t size_in_mb = 1024)
+            : nodes(std::min<uint64_t>((1 << 20) * std::bit_floor(size_in_mb) / sizeof(MCTS_Node), NO_NODE)) {
+    }
+
+    /**
+     * @return The index of the first of count consecutive nodes, or NO_NODE if the pool is full.
+     */
+    uint32_t allocate(uint32_t count) {
+        if (used.load(std::memory_order_relaxed) + count > nodes.size()) { // Don't let failed allocations grow used
+            return NO_NODE;
+        }
+        uint64_t first = used.fetch_add(count, std::memory_order_relaxed);
+        if (first + count > nodes.size()) {
+            return NO_NODE;
+        }
+        return (uint32_t) first;
+    }
+
+    MCTS_Node& operator[](uint32_t index) {
+        return nodes[index];
+    }
+
+    /**
+     * Not thread safe, call this between searches.
+     */
+    void clear() {
+        uint64_t in_use = std::min<uint64_t>(used, nodes.size());
+        for (uint64_t i = 0; i < in_use; i++) {
+            nodes[i].reset();
+        }
+        used = 0;
+    }
+};
+
+class alignas (128) MCTS_Thread { // Let's go big with the alignas just in case
+
+private:
+    Board board;
+    MCTS_Pool& pool;
+    std::vector<uint32_t> path;
+    uint64_t playouts = 0;
+
+    static double win_probability(Eval_Type eval) {
+        return 1 / (1 + std::exp(-eval / mcts_eval_scale));
+    }
+
+    /**
+     * UCT, where threads currently below a child count as lost playouts of it, so that other threads spread out.
+     * Children nobody visited yet come first.
+     */
+    uint32_t select_child(MCTS_Node& node) {
+        uint32_t first = node.first_child.load(std::memory_order_relaxed);
+        uint16_t num_children = node.num_children.load(std::memory_order_relaxed);
+        double parent_visits = node.visits.load(std::memory_order_relaxed)
+                               + mcts_virtual_loss * node.virtual_loss.load(std::memory_order_relaxed);
+        double log_parent_visits = std::log(std::max(parent_visits, 1.0));
+        uint32_t best = first;
+        double best_score = -std::numeric_limits<double>::infinity();
+        for (uint32_t i = first; i < first + num_children; i++) {
+            MCTS_Node& child = pool[i];
+            double visits = child.visits.load(std::memory_order_relaxed)
+                            + mcts_virtual_loss * child.virtual_loss.load(std::memory_order_relaxed);
+            if (visits == 0) {
+                return i;
+            }
+            double score = (double) child.value.load(std::memory_order_relaxed) / (mcts_value_scale * visits)
+                           + mcts_exploration * std::sqrt(log_parent_visits / visits);
+            if (score > best_score) {
+                best_score = score;
+                best = i;
+            }
+        }
+        return best;
+    }
+
+public:
+    explicit MCTS_Thread(Board& board, MCTS_Pool& pool) : board(board), pool(pool) {
+        path.reserve(256);
+    }
+
+    [[nodiscard]] uint64_t get_nodes() const {
+        return playouts;
+    }
+
+    /**
+     * Expands the node belonging to the current board. Only one thread gets to expand a node; others arriving in the
+     * meantime treat it as a leaf. Call this with the board at the node.
+     */
+    void expand(uint32_t index) {
+        MCTS_Node& node = pool[index];
+        MCTS_Node_State expected = UNEXPANDED;
+        if (!node.state.compare_exchange_strong(expected, EXPANDING, std::memory_order_relaxed)) {
+            return;
+        }
+        Movelist moves;
+        Movegen::legalmoves<ALL>(board, moves);
+        uint32_t first = pool.allocate(moves.size);
+        if (first == MCTS_Pool::NO_NODE) { // The pool is full, so this stays a leaf for good
+            return;
+        }
+        for (int i = 0; i < moves.size; i++) {
+            pool[first + i].move = moves[i].move;
+        }
+        node.first_child.store(first, std::memory_order_relaxed);
+        node.num_children.store(moves.size, std::memory_order_relaxed);
+        node.state.store(EXPANDED, std::memory_order_release); // Publishes the children
+    }
+
+    /**
+     * One selection, expansion, evaluation and backpropagation. Instead of a random rollout, the leaf is evaluated
+     * with the static eval turned into a win probability. A node without legal moves counts as lost, the same way the
+     * alpha-beta searches score it as MIN_EVAL.
+     */
+    void playout(uint32_t root) {
+        path.clear();
+        uint32_t index = root;
+        path.push_back(index);
+        pool[index].virtual_loss.fetch_add(1, std::memory_order_relaxed);
+        while (pool[index].state.load(std::memory_order_acquire) == EXPANDED
+               && pool[index].num_children.load(std::memory_order_relaxed) > 0) {
+            index = select_child(pool[index]);
+            board.makeMove(pool[index].move);
+            path.push_back(index);
+            pool[index].virtual_loss.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        MCTS_Node& leaf = pool[index];
+        if (leaf.visits.load(std::memory_order_relaxed) >= mcts_expand_visits) {
+            expand(index);
+        }
+        double result; // Win probability of the side to move at the current node
+        if (leaf.state.load(std::memory_order_acquire) == EXPANDED && leaf.num_children.load(std::memory_order_relaxed) == 0) {
+            result = 0;
+        } else {
+            result = win_probability(board.eval());
+        }
+
+        for (std::size_t i = path.size(); i-- > 0;) {
+            MCTS_Node& node = pool[path[i]];
+            node.value.fetch_add((int64_t) ((1 - result) * mcts_value_scale), std::memory_order_relaxed);
+            node.visits.fetch_add(1, std::memory_order_relaxed);
+            node.virtual_loss.fetch_sub(1, std::memory_order_relaxed);
+            if (i > 0) {
+                board.unmakeMove(node.move);
+            }
+            result = 1 - result;
+        }
+    }
+
+    /**
+     * Runs playouts until the shared counter reaches the budget.
+     */
+    void run(uint32_t root, std::atomic<uint64_t>& started, uint64_t budget) {
+        playouts = 0;
+        while (started.fetch_add(1, std::memory_order_relaxed) < budget) {
+            playout(root);
+            playouts++;
+        }
+    }
+};
+
+/**
+ * Tree parallel MCTS: all threads share one tree in an MCTS_Pool and are spread over it by virtual loss. The "depth" of
+ * the benchmark is the number of steps, each doubling the total playouts, and the tree is kept between steps the same
+ * way the TT is kept between iterations of iterative deepening. The nodes column of the table counts playouts, so nps
+ * is playouts per second.
+ */
+class MCTS_Search {
+
+    size_t num_threads;
+    MCTS_Pool& pool;
+    uint64_t seed = 0;
+    std::vector<MCTS_Thread> searchers;
+
+public:
+    MCTS_Search(size_t num_threads, Board& board, MCTS_Pool& pool) : num_threads(num_threads), pool(pool) {
+        searchers.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; i++) {
+            searchers.emplace_back(board, pool);
+        }
+    }
+
+    /**
+     * Seeds the pseudo random eval, MCTS has no randomness of its own.
+     */
+    void set_seed(uint64_t search_seed) {
+        seed = search_seed;
+    }
+
+    /**
+     * @param up_to_depth Number of steps, step d runs until the tree has mcts_base_playouts * 2^(d - 1) playouts.
+     * @param iteration Optional parameter, if passed will be printed in the output. Useful for automated benchmarks.
+     * The other template parameters only exist to match the alpha-beta searches and are ignored.
+     */
+    template<class Search_Result, bool PV_Search = true, bool Cooperative_Root = false>
+    Search_Result parallel_search(int up_to_depth, int iteration = 0) {
+        Search_Result result;
+        pool.clear();
+        uint32_t root = pool.allocate(1);
+        searchers[0].expand(root);
+        uint64_t done = 0;
+        for (int depth = 1; depth <= up_to_depth; depth++) {
+            uint64_t budget = mcts_base_playouts << (depth - 1);
+            std::vector<std::thread> search_threads;
+            std::atomic<uint64_t> started = done;
+            Load_Balance load_balance(num_threads);
+            std::atomic<uint64_t> allocations = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < num_threads; i++) {
+                auto func = std::bind(&MCTS_Thread::run, &searchers[i], root, std::ref(started), budget);
+                search_threads.emplace_back(load_balance.timed(seeded(counting_allocations(func, allocations), seed, i), i));
+            }
+            for (auto &thread: search_threads) {
+                thread.join();
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> duration = end - start;
+
+            MCTS_Node& root_node = pool[root];
+            uint32_t best = MCTS_Pool::NO_NODE;
+            for (uint32_t i = root_node.first_child; i < root_node.first_child + root_node.num_children; i++) {
+                if (best == MCTS_Pool::NO_NODE || pool[i].visits > pool[best].visits) { // Most visited is the best
+                    best = i;
+                }
+            }
+            result.move = NO_MOVE;
+            result.eval = MIN_EVAL;
+            if (best != MCTS_Pool::NO_NODE && pool[best].visits > 0) {
+                double win = (double) pool[best].value / (mcts_value_scale * pool[best].visits);
+                win = std::clamp(win, 1e-6, 1 - 1e-6);
+                result.move = pool[best].move;
+                result.eval = (Eval_Type) std::clamp(-mcts_eval_scale * std::log(1 / win - 1), (double) MIN_EVAL,
+                                                     (double) MAX_EVAL);
+            }
+            result.depth = depth;
+            result.duration = duration.count();
+            result.nodes = budget - done;
+            for (size_t i = 0; i < num_threads; i++) {
+                load_balance.set_nodes(i, searchers[i].get_nodes());
+            }
+            result.imbalance = load_balance.imbalance();
+            result.heap_allocations = allocations;
+            result.idle_time = load_balance.idle_time(end);
+            result.print_table(iteration, num_threads);
+            done = budget;
+        }
+        return result;
+    }
+};
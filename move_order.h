@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "chess.hpp"
+#include "compile_time_constants.h"
+#include "search_limits.h"
+
+constexpr int piece_values[7] = {100, 320, 330, 500, 900, 0, 0}; // By PieceType, the last one is NONETYPE
+constexpr int32_t history_limit = 1 << 14; // History scores stay within plus minus this
+constexpr int32_t killer_score = 1 << 20; // Above any history score
+constexpr int32_t capture_score = 1 << 24; // Above any killer, for when captures and quiets get ordered together
+
+/**
+ * Whether move takes a piece. En passant does not count, since the square it goes to is empty.
+ */
+inline bool is_capture(Board& board, Move move) {
+    return board.pieceAtB(to(move)) != None;
+}
+
+/**
+ * Most valuable victim first, and among equal victims the least valuable attacker.
+ */
+inline int32_t mvv_lva(Board& board, Move move) {
+    return piece_values[type_of_piece(board.pieceAtB(to(move)))] * 8 - type_of_piece(board.pieceAtB(from(move)));
+}
+
+/**
+ * Sorts captures by mvv_lva, for the q-search. An insertion sort, since the lists are short and the search threads must
+ * not allocate. Without MOVE_ORDERING they stay in generation order.
+ */
+inline void order_captures(Board& board, Movelist& captures) {
+    if constexpr (!MOVE_ORDERING) {
+        return;
+    }
+    for (int i = 0; i < captures.size; i++) {
+        captures[i].value = mvv_lva(board, captures[i].move);
+    }
+    for (int i = 1; i < captures.size; i++) {
+        ExtMove capture = captures[i];
+        int j = i;
+        for (; j > 0 && captures[j - 1].value < capture.value; j--) {
+            captures[j] = captures[j - 1];
+        }
+        captures[j] = capture;
+    }
+}
+
+/**
+ * The quiet move ordering of one search thread: two killer moves per depth, i.e. per ply within an iteration, and a
+ * butterfly history of which quiet moves caused cutoffs. Each thread keeps its own, so the threads don't fight over
+ * cache lines, and so their move orders still differ a bit, which Lazy SMP lives off.
+ */
+class Move_Order {
+
+private:
+    std::array<std::array<Move, 2>, max_search_depth + 1> killers{};
+    std::array<std::array<std::array<int32_t, 64>, 64>, 2> history{}; // By side to move, from and to square
+
+public:
+    /**
+     * Forgets the killers, which belong to the plies of the last iteration, and halves the history, so that it follows
+     * the current iteration more than the earlier ones.
+     */
+    void new_iteration() {
+        killers = {};
+        for (auto& side : history) {
+            for (auto& from_square : side) {
+                for (auto& score : from_square) {
+                    score /= 2;
+                }
+            }
+        }
+    }
+
+    /**
+     * Scores captures by mvv_lva above every quiet move, and quiet moves by killer slot and then history.
+     */
+    [[nodiscard]] int32_t score(Board& board, Move move, int depth) const {
+        if (is_capture(board, move)) {
+            return capture_score + mvv_lva(board, move);
+        }
+        if (killers[depth][0] == move) {
+            return killer_score + 1;
+        }
+        if (killers[depth][1] == move) {
+            return killer_score;
+        }
+        return history[board.sideToMove][from(move)][to(move)];
+    }
+
+    /**
+     * Call this when move caused a cutoff, before making it again. Only quiet moves become killers and get history.
+     */
+    void record_cutoff(Board& board, Move move, int depth) {
+        if (!MOVE_ORDERING || is_capture(board, move)) {
+            return;
+        }
+        if (killers[depth][0] != move) {
+            killers[depth][1] = killers[depth][0];
+            killers[depth][0] = move;
+        }
+        int32_t& entry = history[board.sideToMove][from(move)][to(move)];
+        int32_t bonus = std::min(depth * depth, history_limit);
+        entry += bonus - entry * bonus / history_limit; // Moves entries towards the limit, never past it
+    }
+};
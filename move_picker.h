@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "chess.hpp"
+#include "compile_time_constants.h"
+#include "rng.h"
+#include "move_order.h"
+#include "see.h"
+
+thread_local uint64_t movegen_nanoseconds = 0; // Only counted with TIME_MOVEGEN
+
+/**
+ * Movegen::legalmoves, which with TIME_MOVEGEN also adds the time it took to movegen_nanoseconds of this thread.
+ */
+template<Movetype TYPE>
+void generate_moves(Board& board, Movelist& moves) {
+    if constexpr (TIME_MOVEGEN) {
+        auto start = std::chrono::steady_clock::now();
+        Movegen::legalmoves<TYPE>(board, moves);
+        movegen_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    } else {
+        Movegen::legalmoves<TYPE>(board, moves);
+    }
+}
+
+/**
+ * Wraps a thread function so that it adds the time that thread spends in move generation to nanoseconds.
+ */
+template<class Function>
+auto timing_movegen(Function function, std::atomic<uint64_t>& nanoseconds) {
+    return [function, &nanoseconds]() mutable {
+        uint64_t before = movegen_nanoseconds;
+        function();
+        nanoseconds += movegen_nanoseconds - before;
+    };
+}
+
+/**
+ * Hands out the moves of an interior node one at a time, TT move first. With STAGED_MOVEGEN it plays the TT move
+ * before generating anything, then generates and hands out the captures, and only then the quiet moves, so a node that
+ * cuts off on the TT move or a capture never generates the rest. Without it, it generates all moves up front, which is
+ * what the searches did before.
+ *
+ * The TT move of a knight or slider gets played without checking it against the generated moves. The TTs only compare
+ * the key above its low age bits, so it can come from another position, but a few bitboard tests and a king safety check
+ * catch those moves far cheaper than generating. Pawn and king moves, with their pushes, en passant, promotions and
+ * castling, do get checked against the legal moves. A TT move that fails is skipped, and the later stages hand out all
+ * moves.
+ *
+ * With an rng, each stage is shuffled like generate_shuffled_moves of the searches does it, lazily with LAZY_SHUFFLE.
+ * Without one the moves come in generation order. With MOVE_ORDERING and a Move_Order, each stage gets handed out best
+ * score first instead; an rng then only breaks the ties, which are most quiet moves, so the threads still differ.
+ */
+class Move_Picker {
+
+private:
+    enum Stage : uint8_t { TT_MOVE, GENERATE_CAPTURES, CAPTURES, QUIETS, DONE };
+
+    Board& board;
+    Move tt_move;
+    Counter_RNG* rng;
+    Move_Order* order;
+    int depth;
+    Stage stage = TT_MOVE;
+    Movelist moves;
+    int index = 0;
+    int captures = 0; // Moves at the front of moves that are captures, so the quiet stage can skip them
+
+    /**
+     * Whether move moves one of our pieces, not onto another one of ours, along a line a knight or slider can take, and
+     * leaves our king safe. Pawn and king moves are looked up in the legal moves instead, their rules need the generator.
+     */
+    static bool is_playable(Board& board, Move move) {
+        Color us = board.sideToMove, them = us == White ? Black : White;
+        U64 ours = pieces_of(board, us);
+        Square from_square = from(move), to_square = to(move);
+        if ((ours & (1ULL << from_square)) == 0 || (ours & (1ULL << to_square)) != 0) {
+            return false;
+        }
+        PieceType type = type_of_piece(board.pieceAtB(from_square));
+        if (type == PAWN || type == KING) {
+            Movelist legal;
+            generate_moves<ALL>(board, legal);
+            return legal.find(move) >= 0;
+        }
+        if (promoted(move)) { // Only pawns promote
+            return false;
+        }
+        U64 reach;
+        if (type == KNIGHT) {
+            reach = Attacks::Knight(from_square);
+        } else {
+            reach = (type != ROOK ? Attacks::Bishop(from_square, board.All()) : 0)
+                    | (type != BISHOP ? Attacks::Rook(from_square, board.All()) : 0);
+        }
+        if ((reach & (1ULL << to_square)) == 0) {
+            return false;
+        }
+        board.makeMove(move);
+        bool legal = !board.isSquareAttacked(them, board.KingSQ(us));
+        board.unmakeMove(move);
+        return legal;
+    }
+
+    [[nodiscard]] bool ordered() const {
+        return MOVE_ORDERING && order != nullptr;
+    }
+
+    /**
+     * Call this once the moves from index on are the new stage. Shuffles them right away, unless LAZY_SHUFFLE does it
+     * one move at a time in next, and scores them if ordered.
+     */
+    void prepare_stage() {
+        if (rng != nullptr && (!LAZY_SHUFFLE || ordered())) { // Ordering picks from all of them, so all get shuffled
+            for (int i = index; i < moves.size; i++) {
+                shuffle_step(moves, i, *rng);
+            }
+        }
+        if (ordered()) {
+            for (int i = index; i < moves.size; i++) {
+                moves[i].value = order->score(board, moves[i].move, depth);
+            }
+        }
+    }
+
+    /**
+     * Swaps the best scored move from index on to index, the first one of them if there are several.
+     */
+    void pick_best() {
+        int best = index;
+        for (int i = index + 1; i < moves.size; i++) {
+            if (moves[i].value > moves[best].value) {
+                best = i;
+            }
+        }
+        std::swap(moves[index], moves[best]);
+    }
+
+    void remove_tt_move() {
+        int tt_move_index = moves.find(tt_move);
+        if (tt_move_index >= 0) {
+            moves[tt_move_index] = moves[moves.size - 1];
+            moves.size--;
+        }
+    }
+
+    /**
+     * Appends the moves that are neither captures nor the TT move.
+     */
+    void add_quiets() {
+        Movelist all;
+        generate_moves<ALL>(board, all);
+        for (int i = 0; i < all.size; i++) {
+            Move move = all[i].move;
+            bool seen = move == tt_move;
+            for (int capture = 0; capture < captures && !seen; capture++) {
+                seen = moves[capture].move == move;
+            }
+            if (!seen) {
+                moves[moves.size] = all[i];
+                moves.size++;
+            }
+        }
+    }
+
+public:
+    /**
+     * @param order The killers and history of this thread, or nullptr to not order.
+     */
+    Move_Picker(Board& board, Move tt_move, Counter_RNG* rng, Move_Order* order = nullptr, int depth = 0)
+            : board(board), tt_move(tt_move), rng(rng), order(order), depth(depth) {
+        if constexpr (!STAGED_MOVEGEN) {
+            generate_moves<ALL>(board, moves);
+            if (ordered()) {
+                prepare_stage();
+                int tt_move_index = moves.find(tt_move);
+                if (tt_move_index >= 0) {
+                    moves[tt_move_index].value = INT32_MAX; // Search the TT move first
+                }
+            } else {
+                if (rng != nullptr) {
+                    int shuffled = LAZY_SHUFFLE ? std::min(1, (int) moves.size) : moves.size;
+                    for (int i = 0; i < shuffled; i++) {
+                        shuffle_step(moves, i, *rng);
+                    }
+                }
+                int tt_move_index = moves.find(tt_move);
+                if (tt_move_index > 0) {
+                    std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
+                }
+            }
+            stage = QUIETS; // I.e. the last stage
+        }
+    }
+
+    /**
+     * @return The next move to search, NO_MOVE once there are none left.
+     */
+    Move next() {
+        if constexpr (STAGED_MOVEGEN) {
+            if (stage == TT_MOVE) {
+                stage = GENERATE_CAPTURES;
+                if (tt_move != NO_MOVE && is_playable(board, tt_move)) {
+                    return tt_move;
+                }
+                tt_move = NO_MOVE; // So the later stages don't leave it out
+            }
+            if (stage == GENERATE_CAPTURES) {
+                generate_moves<CAPTURE>(board, moves);
+                remove_tt_move();
+                captures = moves.size;
+                prepare_stage();
+                stage = CAPTURES;
+            }
+            if (stage == CAPTURES && index == moves.size) {
+                add_quiets();
+                prepare_stage();
+                stage = QUIETS;
+            }
+        }
+        if (index == moves.size) {
+            stage = DONE;
+            return NO_MOVE;
+        }
+        if (ordered()) {
+            pick_best();
+        } else if (rng != nullptr && LAZY_SHUFFLE && (STAGED_MOVEGEN || index > 0)) { // Else chosen in the constructor
+            shuffle_step(moves, index, *rng);
+        }
+        return moves[index++].move;
+    }
+};
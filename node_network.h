@@ -0,0 +1,336 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "abdada_tt.h"
+
+constexpr std::size_t remote_batch_size = 256; // Messages to one node that get sent right away instead of on the timer
+constexpr std::chrono::microseconds remote_flush_interval{100}; // Longest a message waits for its batch to fill
+
+enum Message_Type : uint8_t {
+    PROBE, // Asks the owner of a node for its entry, answered by a REPLY
+    CLAIM, // Increments the proc count at the owner, which answers with the new entry
+    STORE, // Writes an entry at the owner, decrementing the proc count if flag is set
+    RELEASE, // Decrements the proc count at the owner
+    REPLY, // The entry of the owner, flag is 0 if it had none, then info is empty
+    DONE, // Sent to every node by one that completed the search, info carries move, eval and depth of its result
+    NODE_COUNT, // Sent to node 0 once done, key carries the count
+    MESSAGE_COUNT // Likewise
+};
+
+struct __attribute__((packed)) Remote_Message {
+    Message_Type type;
+    uint8_t flag;
+    int8_t depth;
+    uint64_t key;
+    ABDADA_TT_Info info;
+};
+
+/**
+ * TCP connections from this node to every other one, here all on 127.0.0.1. Anyone can send a message to a node any
+ * time, it goes into the outbox of that node and one sender thread writes each outbox as one batch once it is full or
+ * remote_flush_interval passed. One receiver thread per node hands what arrives to the handler. Receivers never wait
+ * for the network themselves, so two nodes can't block each other by both sending a lot at once.
+ */
+class Node_Network {
+
+private:
+    struct Outbox {
+        std::mutex mutex;
+        std::vector<Remote_Message> messages;
+    };
+
+    std::size_t node;
+    std::vector<int> sockets; // By node, -1 for ourselves
+    std::vector<Outbox> outboxes;
+    std::function<void(std::size_t, const Remote_Message&)> handler;
+
+    std::mutex flush_mutex;
+    std::condition_variable flush_signal;
+    bool flush_now = false, closing = false;
+    std::thread sender;
+    std::vector<std::thread> receivers;
+
+    std::atomic<uint64_t> messages_sent = 0;
+    std::atomic<uint64_t> batches_sent = 0;
+
+    static bool write_all(int socket, const void* data, std::size_t bytes) {
+        auto* position = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t written = ::send(socket, position, bytes, MSG_NOSIGNAL);
+            if (written <= 0) {
+                return false;
+            }
+            position += written;
+            bytes -= written;
+        }
+        return true;
+    }
+
+    static bool read_all(int socket, void* data, std::size_t bytes) {
+        auto* position = static_cast<char*>(data);
+        while (bytes > 0) {
+            ssize_t got = read(socket, position, bytes);
+            if (got <= 0) {
+                return false;
+            }
+            position += got;
+            bytes -= got;
+        }
+        return true;
+    }
+
+    void flush_all() {
+        std::vector<Remote_Message> batch;
+        for (std::size_t peer = 0; peer < sockets.size(); peer++) {
+            if (sockets[peer] < 0) {
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> guard(outboxes[peer].mutex);
+                batch.swap(outboxes[peer].messages);
+            }
+            if (!batch.empty()) {
+                write_all(sockets[peer], batch.data(), batch.size() * sizeof(Remote_Message)); // A node that is gone
+                batches_sent++;                                                                    // misses nothing
+                batch.clear();
+            }
+        }
+    }
+
+    void send_loop() {
+        for (;;) {
+            bool last;
+            {
+                std::unique_lock<std::mutex> lock(flush_mutex);
+                flush_signal.wait_for(lock, remote_flush_interval, [this]() { return flush_now || closing; });
+                flush_now = false;
+                last = closing;
+            }
+            flush_all();
+            if (last) {
+                return;
+            }
+        }
+    }
+
+    void receive_loop(std::size_t peer) {
+        std::vector<char> buffer(1 << 16);
+        std::size_t filled = 0;
+        for (;;) {
+            ssize_t got = read(sockets[peer], buffer.data() + filled, buffer.size() - filled);
+            if (got <= 0) { // The peer is done
+                return;
+            }
+            filled += got;
+            std::size_t complete = filled / sizeof(Remote_Message) * sizeof(Remote_Message);
+            for (std::size_t offset = 0; offset < complete; offset += sizeof(Remote_Message)) {
+                Remote_Message message{};
+                std::memcpy(&message, buffer.data() + offset, sizeof(Remote_Message));
+                handler(peer, message);
+            }
+            std::memmove(buffer.data(), buffer.data() + complete, filled - complete); // The start of the next message
+            filled -= complete;
+        }
+    }
+
+public:
+    /**
+     * Opens a listening socket on 127.0.0.1 for each node, on a port the system picks. Do this before starting the
+     * node processes, so that each one can connect to the ones before it without waiting for them to listen.
+     * @return The sockets, or nothing if one could not be opened.
+     */
+    static std::vector<int> listen_loopback(std::size_t nodes, std::vector<uint16_t>& ports) {
+        std::vector<int> listeners;
+        ports.clear();
+        for (std::size_t i = 0; i < nodes; i++) {
+            int listener = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = 0;
+            socklen_t length = sizeof(address);
+            if (listener < 0 || bind(listener, (sockaddr*) &address, sizeof(address)) < 0
+                || listen(listener, (int) nodes) < 0 || getsockname(listener, (sockaddr*) &address, &length) < 0) {
+                std::cerr << "Cannot listen on 127.0.0.1: " << std::strerror(errno) << std::endl;
+                if (listener >= 0) {
+                    close(listener);
+                }
+                for (int open : listeners) {
+                    close(open);
+                }
+                return {};
+            }
+            listeners.push_back(listener);
+            ports.push_back(ntohs(address.sin_port));
+        }
+        return listeners;
+    }
+
+    /**
+     * Connects node to every other node: it connects to the ones before it and accepts the ones after it. Closes all
+     * the listeners, which every node process got a copy of.
+     */
+    Node_Network(std::size_t node, const std::vector<int>& listeners, const std::vector<uint16_t>& ports)
+            : node(node), sockets(ports.size(), -1), outboxes(ports.size()) {
+        for (std::size_t peer = 0; peer < node; peer++) {
+            int connection = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(ports[peer]);
+            uint32_t id = node;
+            if (connection < 0 || connect(connection, (sockaddr*) &address, sizeof(address)) < 0
+                || !write_all(connection, &id, sizeof(id))) {
+                std::cerr << "Node " << node << " cannot connect to node " << peer << ": " << std::strerror(errno) << std::endl;
+                if (connection >= 0) {
+                    close(connection);
+                }
+                continue;
+            }
+            sockets[peer] = connection;
+        }
+        for (std::size_t accepted = node + 1; accepted < ports.size(); accepted++) {
+            int connection = accept(listeners[node], nullptr, nullptr);
+            uint32_t id = 0;
+            if (connection < 0 || !read_all(connection, &id, sizeof(id)) || id <= node || id >= ports.size()
+                || sockets[id] >= 0) {
+                std::cerr << "Node " << node << " got a broken connection" << std::endl;
+                if (connection >= 0) {
+                    close(connection);
+                }
+                continue;
+            }
+            sockets[id] = connection;
+        }
+        for (int listener : listeners) {
+            close(listener);
+        }
+        int no_delay = 1; // We batch ourselves
+        for (int connection : sockets) {
+            if (connection >= 0) {
+                setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+            }
+        }
+    }
+
+    Node_Network(const Node_Network&) = delete;
+    Node_Network& operator=(const Node_Network&) = delete;
+
+    ~Node_Network() {
+        close_connections();
+    }
+
+    [[nodiscard]] bool is_connected() const {
+        for (std::size_t peer = 0; peer < sockets.size(); peer++) {
+            if (peer != node && sockets[peer] < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    [[nodiscard]] std::size_t get_node() const {
+        return node;
+    }
+
+    [[nodiscard]] std::size_t get_nodes() const {
+        return sockets.size();
+    }
+
+    [[nodiscard]] uint64_t get_messages_sent() const {
+        return messages_sent;
+    }
+
+    [[nodiscard]] uint64_t get_batches_sent() const {
+        return batches_sent;
+    }
+
+    /**
+     * Starts sending and receiving. The handler gets called from the receiver threads, concurrently for different
+     * peers, and has to stay valid until close_connections returns.
+     */
+    void start(std::function<void(std::size_t, const Remote_Message&)> message_handler) {
+        handler = std::move(message_handler);
+        sender = std::thread(&Node_Network::send_loop, this);
+        for (std::size_t peer = 0; peer < sockets.size(); peer++) {
+            if (sockets[peer] >= 0) {
+                receivers.emplace_back(&Node_Network::receive_loop, this, peer);
+            }
+        }
+    }
+
+    /**
+     * Thread safe. Messages to the same node arrive in the order they were sent.
+     */
+    void send(std::size_t peer, const Remote_Message& message) {
+        if (sockets[peer] < 0) {
+            return;
+        }
+        messages_sent++;
+        bool full;
+        {
+            std::lock_guard<std::mutex> guard(outboxes[peer].mutex);
+            outboxes[peer].messages.push_back(message);
+            full = outboxes[peer].messages.size() >= remote_batch_size;
+        }
+        if (full) {
+            {
+                std::lock_guard<std::mutex> guard(flush_mutex);
+                flush_now = true;
+            }
+            flush_signal.notify_one();
+        }
+    }
+
+    void broadcast(const Remote_Message& message) {
+        for (std::size_t peer = 0; peer < sockets.size(); peer++) {
+            if (peer != node) {
+                send(peer, message);
+            }
+        }
+    }
+
+    /**
+     * Sends what is left and tells every node that we are done, then waits until every node did the same. So node 0
+     * can collect what the others send it last before it returns.
+     */
+    void close_connections() {
+        if (sender.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(flush_mutex);
+                closing = true;
+            }
+            flush_signal.notify_one();
+            sender.join();
+        }
+        for (int connection : sockets) {
+            if (connection >= 0) {
+                shutdown(connection, SHUT_WR);
+            }
+        }
+        for (auto& receiver : receivers) {
+            receiver.join();
+        }
+        receivers.clear();
+        for (int& connection : sockets) {
+            if (connection >= 0) {
+                close(connection);
+                connection = -1;
+            }
+        }
+    }
+};
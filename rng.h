@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Counter based random numbers: the n-th number of a stream is a bit mix of the seed, the stream and n, there is no
+ * state besides the counter. So each stream is reproducible on its own, no matter how many numbers other streams drew
+ * or in which order the threads drawing them ran. Every search thread gets its own stream, so a single threaded search
+ * with a given seed repeats exactly, and multithreaded runs only differ through scheduling.
+ */
+class Counter_RNG {
+
+private:
+    static constexpr uint64_t golden_gamma = 0x9e3779b97f4a7c15ULL;
+
+    uint64_t key = 0;
+    uint64_t counter = 0;
+
+    /**
+     * The SplitMix64 finalizer, which is a bijection, so different inputs never collide.
+     */
+    static constexpr uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+public:
+    Counter_RNG() = default;
+
+    Counter_RNG(uint64_t seed, uint64_t stream) : key(mix(mix(seed) + stream * golden_gamma)) {
+    }
+
+    uint64_t operator()() {
+        return mix(key + ++counter * golden_gamma);
+    }
+
+    /**
+     * A number in [0, range) without a division in the common case: Lemire's multiply and shift, which maps the upper
+     * 32 bits onto the range. The rejection step, which needs the only modulo, runs for fewer than range in 2^32 draws
+     * and keeps the result unbiased.
+     */
+    uint32_t bounded(uint32_t range) {
+        uint64_t product = (operator()() >> 32) * range;
+        auto low = (uint32_t) product;
+        if (low < range) {
+            uint32_t threshold = -range % range;
+            while (low < threshold) {
+                product = (operator()() >> 32) * range;
+                low = (uint32_t) product;
+            }
+        }
+        return product >> 32;
+    }
+};
@@ -0,0 +1,22 @@
+#!/usr/bin/env python3
+"""Sends analysis requests to a running "parallel_gametree_search server <socket>" and prints what comes back.
+
+    server_client.py <socket> <fen> [depth] [priority]
+
+Prints each info and result line as it arrives and exits after the result.
+"""
+import json
+import socket
+import sys
+
+path, fen = sys.argv[1], sys.argv[2]
+request = {"id": "client", "fen": fen, "depth": int(sys.argv[3]) if len(sys.argv) > 3 else 10,
+           "priority": int(sys.argv[4]) if len(sys.argv) > 4 else 1}
+
+with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as connection:
+    connection.connect(path)
+    connection.sendall((json.dumps(request) + "\n").encode())
+    for line in connection.makefile():
+        print(line, end="")
+        if json.loads(line)["type"] in ("result", "error"):
+            break
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include "stop_signal.h"
+#include "live_stats.h"
+
+constexpr int max_search_depth = 100;
+constexpr double default_iteration_growth = 4; // Assumed time factor from one iteration to the next until we measured one
+constexpr std::chrono::milliseconds limit_watch_interval{1};
+
+/**
+ * When a search ends. A search stops at whichever limit it reaches first; 0 means no limit on nodes or time. An
+ * infinite search ignores all limits and only ends when it is halted from outside, see Search_Clock::halt.
+ */
+struct Search_Limits {
+    int depth = max_search_depth;
+    uint64_t nodes = 0;
+    std::chrono::milliseconds time{0};
+    bool infinite = false;
+
+    static Search_Limits to_depth(int depth) {
+        Search_Limits limits;
+        limits.depth = depth;
+        return limits;
+    }
+};
+
+/**
+ * Keeps track of the limits of the running search. Time has a soft and a hard limit: the soft one keeps the search from
+ * starting an iteration that likely won't finish in time, the hard one halts the running iteration, see Limit_Watcher.
+ * Halting sets the stop signal like a finished iteration does, except that no thread gets to report a result, so the
+ * search keeps the result of the last completed iteration, or the best root move completed in the halted one. A halt
+ * before the search starts ends it right away, and finishing a search consumes the halt.
+ */
+class Search_Clock {
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Search_Limits limits;
+    Clock::time_point start;
+    std::atomic<Stop_Signal*> signal = nullptr; // Atomic since halt can come from any thread at any time
+    std::atomic<bool> halted = false;
+    std::atomic<Clock::rep> halted_at = 0; // Ticks since the clock's epoch
+
+public:
+    /**
+     * Not thread safe, call this before starting the search threads.
+     */
+    void start_search(const Search_Limits& search_limits, Stop_Signal& stop_signal) {
+        limits = search_limits;
+        signal = &stop_signal;
+        start = Clock::now();
+    }
+
+    /**
+     * Not thread safe, call this once the search threads are done.
+     */
+    void finish_search() {
+        halted = false;
+        halted_at = 0;
+    }
+
+    [[nodiscard]] const Search_Limits& get_limits() const {
+        return limits;
+    }
+
+    /**
+     * Stops the search. Thread safe, call this from outside to end an infinite search.
+     */
+    void halt() {
+        halt(Clock::now());
+    }
+
+    /**
+     * As above, for a search that reached a hard limit at limit_reached, which the halt latency gets measured from.
+     */
+    void halt(Clock::time_point limit_reached) {
+        Clock::rep not_halted = 0;
+        halted_at.compare_exchange_strong(not_halted, limit_reached.time_since_epoch().count()); // The first halt counts
+        halted.store(true, std::memory_order_release); // Before the signal, so whoever sees the signal sees this
+        if (Stop_Signal* stop_signal = signal.load()) {
+            stop_signal->stop();
+        }
+    }
+
+    [[nodiscard]] bool is_halted() const {
+        return halted.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] double elapsed() const {
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        return elapsed.count();
+    }
+
+    /**
+     * @return Seconds since the search got halted, or since it reached the limit it got halted for.
+     */
+    [[nodiscard]] double halt_latency() const {
+        std::chrono::duration<double> latency = Clock::now().time_since_epoch() - Clock::duration(halted_at.load());
+        return latency.count();
+    }
+
+    [[nodiscard]] bool needs_watching() const {
+        return !limits.infinite && (limits.nodes > 0 || limits.time.count() > 0);
+    }
+
+    /**
+     * Checks the hard limits against a sample of the node count, given the sample before it.
+     * @return When the search reached a hard limit: the deadline, or for the node limit the time between the two samples
+     * at which the node count would have crossed it at a steady nps. Nothing if no limit is reached.
+     */
+    [[nodiscard]] std::optional<Clock::time_point> hard_limit_reached(uint64_t nodes, Clock::time_point sampled,
+                                                                      uint64_t previous_nodes,
+                                                                      Clock::time_point previous_sample) const {
+        if (limits.infinite) {
+            return std::nullopt;
+        }
+        std::optional<Clock::time_point> reached;
+        if (limits.time.count() > 0 && sampled - start >= limits.time) {
+            reached = start + limits.time;
+        }
+        if (limits.nodes > 0 && nodes >= limits.nodes) {
+            Clock::time_point crossed = sampled;
+            if (previous_nodes < limits.nodes && nodes > previous_nodes) {
+                double share = (double) (limits.nodes - previous_nodes) / (double) (nodes - previous_nodes);
+                crossed = previous_sample + std::chrono::duration_cast<Clock::duration>((sampled - previous_sample) * share);
+            }
+            reached = reached ? std::min(*reached, crossed) : crossed;
+        }
+        return reached;
+    }
+
+    /**
+     * @param last_iteration Seconds the last iteration took.
+     * @param growth Expected factor between the time of the last iteration and the next one.
+     * @return true if the next iteration would likely not finish before the hard time limit.
+     */
+    [[nodiscard]] bool soft_limit_reached(double last_iteration, double growth) const {
+        if (limits.infinite || limits.time.count() == 0) {
+            return false;
+        }
+        std::chrono::duration<double> time_limit = limits.time;
+        return elapsed() + last_iteration * growth > time_limit.count();
+    }
+};
+
+/**
+ * Checks the hard limits of a search every limit_watch_interval on a thread of its own, and halts the search once one
+ * is reached. Nodes are sampled from the Live_Stats, so the node limit can be overshot by STOP_POLL_NODES per thread.
+ */
+class Limit_Watcher {
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake_up;
+    bool stopping = false;
+    std::thread thread;
+
+public:
+    Limit_Watcher(Search_Clock& clock, const Live_Stats& stats) {
+        thread = std::thread([this, &clock, &stats]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto previous_sample = std::chrono::steady_clock::now();
+            uint64_t previous_nodes = 0;
+            while (!wake_up.wait_for(lock, limit_watch_interval, [this]() { return stopping; })) {
+                uint64_t nodes = stats.sample().nodes;
+                auto sampled = std::chrono::steady_clock::now();
+                if (auto reached = clock.hard_limit_reached(nodes, sampled, previous_nodes, previous_sample)) {
+                    clock.halt(*reached);
+                    return;
+                }
+                previous_sample = sampled;
+                previous_nodes = nodes;
+            }
+        });
+    }
+
+    Limit_Watcher(const Limit_Watcher&) = delete;
+    Limit_Watcher& operator=(const Limit_Watcher&) = delete;
+
+    ~Limit_Watcher() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+        }
+        wake_up.notify_one();
+        thread.join();
+    }
+};
+
+/**
+ * @return The expected factor between the time of the next iteration and the last one, from the last two iterations.
+ */
+inline double iteration_growth(double last_iteration, double previous_iteration) {
+    if (previous_iteration <= 0 || last_iteration <= 0) {
+        return default_iteration_growth;
+    }
+    return std::clamp(last_iteration / previous_iteration, 1.0, 4 * default_iteration_growth);
+}
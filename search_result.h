@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include "chess.hpp"
+#include "compile_time_constants.h"
+#include "alloc_counter.h"
+#include "search_limits.h"
+
+std::ofstream out;
+
+template <class T>
+void print(const T& t, size_t w)
+{
+    out.width(w);
+    out  << t << " " << std::flush;
+    std::cout.width(w);
+    std::cout << t << " " << std::flush;
+}
+
+void print_headline()
+{
+    print("it", 3);
+    print("num_thr", 7);
+    print("ply", 4);
+    print("time" , 11);
+    print("nps", 9);
+    print("eval", 5);
+    print("nodes", 15);
+    print("move", 5);
+    if constexpr (CUTOFF_PROPAGATION) {
+        print("saved", 15);
+    }
+    print("imbal", 6);
+    print("idle", 9);
+    print("stop_lat", 9);
+    print("defer", 6);
+    print("cas_fail", 9);
+    print("overflow", 9);
+    if constexpr (WORK_STEALING) {
+        print("stolen", 8);
+    }
+    if constexpr (COUNT_ALLOCATIONS) {
+        print("allocs", 8);
+    }
+    if constexpr (TIME_MOVEGEN) {
+        print("movegen", 9);
+    }
+    out       << std::endl;
+    std::cout << std::endl;
+}
+
+struct Search_Result {
+    uint64_t nodes = 0;
+    double duration = 0;
+    Move move = Chess::NO_MOVE;
+    Eval_Type eval = 0;
+    uint16_t depth = 0;
+    uint64_t nodes_saved = 0; // Estimated nodes not searched thanks to cutoff propagation, only set by the ABDADA searches
+    double imbalance = 0; // Most nodes searched by any thread divided by the average per thread
+    double idle_time = 0; // Seconds threads spent waiting for the others after finishing, summed over all threads
+    double stop_latency = 0; // Seconds from the iteration being decided until the last thread stopped
+    double halt_latency = 0; // Seconds from hitting a search limit until the result was returned, see Search_Limits
+    uint64_t jobs_stolen = 0; // Deferred moves searched by a thread other than the one that deferred them
+    uint64_t failed_swaps = 0; // Contention on the currently searched table, only set by Simplified ABDADA
+    uint64_t overflows = 0; // Positions searched without registering because their line was full, same
+    double defer_depth = 0; // Defer depth the threads ended the iteration with, averaged, only set by the ABDADA searches
+    uint64_t heap_allocations = 0; // Made by the search threads, only counted in debug builds, see alloc_counter.h
+    double movegen_time = 0; // Seconds the search threads spent generating moves, summed, only with TIME_MOVEGEN
+
+    void print_human_readable() const {
+        std::cout << "Depth " << depth << ": " << convertMoveToUci(move) << " eval " << eval << " nodes " << nodes
+                  << " time " << duration << " nps " << (nodes / duration) << " saved " << nodes_saved
+                  << " imbalance " << imbalance << " idle " << idle_time << " stop latency " << stop_latency
+                  << " halt latency " << halt_latency << " stolen " << jobs_stolen
+                  << " defer depth " << defer_depth << " failed swaps " << failed_swaps << " overflows " << overflows
+                  << " allocations " << heap_allocations << " movegen " << movegen_time << std::endl;
+    }
+
+    void print_table(int iteration, int num_threads) const {
+        if constexpr (PRINT_TO_FILE) {
+            print_for_file(iteration, num_threads);
+        } else {
+            std::cout << iteration << "\t" << depth << "\t" << duration << "\t" << (nodes / duration) << "\t" << eval
+                      << "\t" << nodes << "\t" << convertMoveToUci(move) << "\t" << nodes_saved << "\t" << imbalance
+                      << "\t" << idle_time << "\t" << stop_latency << "\t" << jobs_stolen << "\t" << defer_depth
+                      << "\t" << failed_swaps << "\t" << overflows << "\t" << heap_allocations << "\t" << movegen_time
+                      << std::endl;
+        }
+    }
+
+    void print_for_file(int iteration, int num_threads) const {
+        print(iteration, 3);
+        print(num_threads, 7);
+        print(depth, 4);
+        print(duration, 11);
+        print((std::size_t) (nodes / duration), 9);
+        print(eval, 5);
+        print(nodes, 15);
+        print(convertMoveToUci(move), 5);
+        if constexpr (CUTOFF_PROPAGATION) {
+            print(nodes_saved, 15);
+        }
+        print(imbalance, 6);
+        print(idle_time, 9);
+        print(stop_latency, 9);
+        print(defer_depth, 6);
+        print(failed_swaps, 9);
+        print(overflows, 9);
+        if constexpr (WORK_STEALING) {
+            print(jobs_stolen, 8);
+        }
+        if constexpr (COUNT_ALLOCATIONS) {
+            print(heap_allocations, 8);
+        }
+        if constexpr (TIME_MOVEGEN) {
+            print(movegen_time, 9);
+        }
+        out << std::endl;
+        std::cout << std::endl;
+    }
+};
+
+/**
+ * Remembers when each depth got completed, for measuring time to depth. Printing nothing itself, print_table is the
+ * hook the searches call after every iteration.
+ */
+struct Timed_Result : Search_Result {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    mutable std::array<double, max_search_depth + 1> time_to_depth{}; // Seconds since the search started
+
+    void print_table(int, int) const {
+        record_depth();
+    }
+
+    /**
+     * @return Seconds since the search started.
+     */
+    double record_depth() const {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        time_to_depth[depth] = elapsed.count();
+        return elapsed.count();
+    }
+};
+
+/**
+ * Also sums the nodes of all iterations, for comparing whole searches rather than their last iteration.
+ */
+struct Summed_Result : Timed_Result {
+    mutable uint64_t total_nodes = 0;
+
+    void print_table(int, int) const {
+        record_depth();
+        total_nodes += nodes;
+    }
+};
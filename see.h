@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "chess.hpp"
+#include "compile_time_constants.h"
+#include "move_order.h"
+
+constexpr int delta_margin = 200; // What a capture may gain beyond the victim's value, e.g. through the PST, for DELTA_PRUNING
+
+inline Piece piece_of(Color color, PieceType type) {
+    return Piece(type + 6 * color);
+}
+
+inline U64 pieces_of(Board& board, Color color) {
+    U64 pieces = 0;
+    for (int type = PAWN; type <= KING; type++) {
+        pieces |= board.piecesBB[piece_of(color, PieceType(type))];
+    }
+    return pieces;
+}
+
+/**
+ * Every piece of either side that attacks square, with the sliders seeing through what is not in occupied.
+ */
+inline U64 attackers_to(Board& board, Square square, U64 occupied) {
+    U64 knights = board.piecesBB[WhiteKnight] | board.piecesBB[BlackKnight];
+    U64 kings = board.piecesBB[WhiteKing] | board.piecesBB[BlackKing];
+    U64 queens = board.piecesBB[WhiteQueen] | board.piecesBB[BlackQueen];
+    U64 diagonal = board.piecesBB[WhiteBishop] | board.piecesBB[BlackBishop] | queens;
+    U64 straight = board.piecesBB[WhiteRook] | board.piecesBB[BlackRook] | queens;
+    return ((Attacks::Pawn(square, Black) & board.piecesBB[WhitePawn])
+            | (Attacks::Pawn(square, White) & board.piecesBB[BlackPawn])
+            | (Attacks::Knight(square) & knights) | (Attacks::King(square) & kings)
+            | (Attacks::Bishop(square, occupied) & diagonal) | (Attacks::Rook(square, occupied) & straight)) & occupied;
+}
+
+/**
+ * Static exchange evaluation: the material the side to move wins with capture, if both sides then keep recapturing on
+ * the same square with their least valuable piece as long as that pays off. Works on the bitboards alone, without
+ * making any move.
+ */
+inline int see(Board& board, Move capture) {
+    Square target = to(capture);
+    U64 occupied = board.All();
+    U64 from_set = 1ULL << from(capture);
+    PieceType attacker = type_of_piece(board.pieceAtB(from(capture)));
+    Piece victim = board.pieceAtB(target);
+    Color side = board.sideToMove;
+
+    int gain[32];
+    int exchanges = 0;
+    gain[0] = piece_values[victim == None ? PAWN : type_of_piece(victim)]; // An empty target square is en passant
+    for (;;) {
+        exchanges++;
+        gain[exchanges] = piece_values[attacker] - gain[exchanges - 1]; // If the piece we just moved there gets taken
+        if (std::max(-gain[exchanges - 1], gain[exchanges]) < 0) { // Neither side wants to continue from here
+            break;
+        }
+        occupied ^= from_set;
+        side = side == White ? Black : White;
+        U64 attackers = attackers_to(board, target, occupied);
+        U64 ours = 0;
+        for (int type = PAWN; type <= KING; type++) {
+            ours = attackers & board.piecesBB[piece_of(side, PieceType(type))];
+            if (ours != 0) {
+                attacker = PieceType(type);
+                break;
+            }
+        }
+        if (ours == 0 || exchanges == 31) {
+            break;
+        }
+        if (attacker == KING && (attackers & ~pieces_of(board, side)) != 0) { // The king can't capture onto a defended square
+            break;
+        }
+        from_set = ours & -ours;
+    }
+    while (--exchanges > 0) {
+        gain[exchanges - 1] = -std::max(-gain[exchanges - 1], gain[exchanges]);
+    }
+    return gain[0];
+}
+
+/**
+ * Whether the q-search can skip capture: with SEE_PRUNING if it loses material, with DELTA_PRUNING if even winning the
+ * victim plus delta_margin can't lift stand_pat above alpha.
+ */
+inline bool prune_capture(Board& board, Move capture, Eval_Type stand_pat, Eval_Type alpha) {
+    if constexpr (DELTA_PRUNING) {
+        Piece victim = board.pieceAtB(to(capture));
+        if ((int) stand_pat + piece_values[victim == None ? PAWN : type_of_piece(victim)] + delta_margin <= alpha) {
+            return true;
+        }
+    }
+    if constexpr (SEE_PRUNING) {
+        return see(board, capture) < 0;
+    }
+    return false;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "chess.hpp"
+#include "compile_time_constants.h"
+#include "see.h"
+
+constexpr bool SELECTIVE_SEARCH = NULL_MOVE_PRUNING || LATE_MOVE_REDUCTIONS || FUTILITY_PRUNING;
+constexpr int null_move_reduction = 2; // The null move gets searched this much shallower than the moves would be
+constexpr int null_move_min_depth = 3;
+constexpr int lmr_min_depth = 3;
+constexpr int lmr_full_depth_moves = 3; // Moves every node searches at full depth before it starts reducing
+constexpr int futility_max_depth = 2;
+constexpr int futility_margin = 150; // Per depth left, what the quiet moves of a node may still gain over its static eval
+
+inline bool in_check(Board& board) {
+    Color us = board.sideToMove, them = us == White ? Black : White;
+    return board.isSquareAttacked(them, board.KingSQ(us));
+}
+
+/**
+ * Whether the side to move has anything besides king and pawns. Without, zugzwang is too common to trust a null move.
+ */
+inline bool has_pieces(Board& board) {
+    for (int type = KNIGHT; type <= QUEEN; type++) {
+        if (board.piecesBB[piece_of(board.sideToMove, PieceType(type))] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * What a null window node needs to decide on null move pruning, futility pruning and late move reductions. Create it
+ * after the TT probe, so that TT cutoffs don't pay for the check test and the static eval. With none of the toggles on
+ * it does nothing, and the null window searches are the plain fixed depth ones again.
+ *
+ * PV nodes stay unpruned and unreduced: they are few, and the speedups we measure should come from the same PV.
+ */
+class Selectivity {
+
+private:
+    bool check = false;
+    bool null_move_possible = false;
+    bool futile = false;
+    int static_eval = 0; // Only computed where null move or futility pruning may use it
+
+public:
+    Selectivity(Board& board, Eval_Type beta, int depth) {
+        if constexpr (SELECTIVE_SEARCH) {
+            check = in_check(board);
+            bool null_move_depth = NULL_MOVE_PRUNING && depth >= null_move_min_depth;
+            bool futility_depth = FUTILITY_PRUNING && depth <= futility_max_depth;
+            if (!check && (null_move_depth || futility_depth)) {
+                static_eval = board.eval();
+                null_move_possible = null_move_depth && static_eval >= beta && has_pieces(board);
+                futile = futility_depth && static_eval + futility_margin * depth < beta;
+            }
+        }
+    }
+
+    /**
+     * Whether to first search a null move, at depth - 1 - null_move_reduction. If even passing reaches beta, the node
+     * cuts off without searching a move.
+     */
+    [[nodiscard]] bool null_move() const {
+        return null_move_possible;
+    }
+
+    /**
+     * Call this after making the move. Whether futility pruning skips it: a quiet move, not the first one, that gives no
+     * check, in a node whose static eval is too far below beta for a quiet move to make up.
+     * @param quiet Whether the move captures nothing, decided before making it.
+     */
+    [[nodiscard]] bool skip(Board& board, bool quiet, int move_index) const {
+        return futile && quiet && move_index > 0 && !in_check(board);
+    }
+
+    /**
+     * What the moves that skip prunes could reach at most, static eval plus futility margin. The node's eval has to be
+     * at least this, or the upper bound it stores would be lower than what the skipped moves might be worth.
+     */
+    [[nodiscard]] Eval_Type futility_bound(int depth) const {
+        return (Eval_Type) (static_eval + futility_margin * depth);
+    }
+
+    /**
+     * Call this after making the move. By how much late move reductions reduce it: quiet moves that give no check, after
+     * the first lmr_full_depth_moves, by one ply, late moves of deep nodes by two. The reduced depth is always at least
+     * one. If the reduced search reaches beta, the caller searches the move again at full depth.
+     */
+    [[nodiscard]] int reduction(Board& board, bool quiet, int move_index, int depth) const {
+        if (!LATE_MOVE_REDUCTIONS || depth < lmr_min_depth || move_index < lmr_full_depth_moves || !quiet || check
+            || in_check(board)) {
+            return 0;
+        }
+        return depth >= 6 && move_index >= 4 * lmr_full_depth_moves ? 2 : 1;
+    }
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include "search_result.h"
+#include "search_limits.h"
+#include "locking_tt.h"
+#include "abdada_tt.h"
+#include "simple_concurrent_search.h"
+#include "abdada_search.h"
+#include "simplified_abdada.h"
+
+/**
+ * Searches board to depth once with one thread and once with threads threads, each on a fresh TT of hash_size MB, and
+ * prints the time to each depth of both, how many more nodes the parallel search needed, and its speedup.
+ */
+template<class Transposition_Table, class Search>
+void compare_scaling(const std::string& name, Board& board, std::size_t threads, int depth, uint64_t hash_size) {
+    std::size_t thread_counts[2] = {1, threads};
+    Summed_Result results[2];
+    for (int run = 0; run < 2; run++) {
+        Transposition_Table tt(hash_size);
+        Search search(thread_counts[run], board, tt);
+        search.set_seed(0);
+        results[run] = search.template parallel_search<Summed_Result, true>(Search_Limits::to_depth(depth));
+    }
+
+    std::cout << name << std::endl << "ply\t1 thread\t" << threads << " threads" << std::endl;
+    for (int ply = 1; ply <= depth; ply++) {
+        std::cout << ply << "\t" << results[0].time_to_depth[ply] << "\t" << results[1].time_to_depth[ply] << std::endl;
+    }
+    double overhead = results[0].total_nodes ? (double) results[1].total_nodes / (double) results[0].total_nodes - 1 : 0;
+    std::cout << "nodes " << results[0].total_nodes << " / " << results[1].total_nodes << ", overhead " << overhead
+              << ", speedup " << results[0].time_to_depth[depth] / results[1].time_to_depth[depth] << std::endl;
+}
+
+/**
+ * Time to depth, search overhead and speedup of Lazy SMP, ABDADA and Simplified ABDADA on the start position. Whether
+ * the tree is selective is decided at compile time, so run this from a build with NULL_MOVE_PRUNING,
+ * LATE_MOVE_REDUCTIONS and FUTILITY_PRUNING and from one without, to see whether the ranking of the algorithms holds on
+ * a tree like that of a competitive engine. The first line says which build this is.
+ */
+inline void run_selective_benchmark(std::size_t threads, int depth, uint64_t hash_size) {
+    Board board;
+    board.applyFen(DEFAULT_POS);
+    std::cout << std::boolalpha << "null move pruning " << NULL_MOVE_PRUNING << ", late move reductions "
+              << LATE_MOVE_REDUCTIONS << ", futility pruning " << FUTILITY_PRUNING << ", SEE pruning " << SEE_PRUNING
+              << std::noboolalpha << std::endl;
+    compare_scaling<Locking_TT<REPLACE_LAST_ENTRY>, Lazy_SMP<true, REPLACE_LAST_ENTRY>>("lazy", board, threads, depth,
+                                                                                       hash_size);
+    compare_scaling<ABDADA_TT<REPLACE_LAST_ENTRY>, ABDADA_Search<true, REPLACE_LAST_ENTRY>>("abdada", board, threads,
+                                                                                           depth, hash_size);
+    compare_scaling<Locking_TT<REPLACE_LAST_ENTRY>, Simplified_ABDADA_Search<true, REPLACE_LAST_ENTRY>>("simple-abdada",
+                                                                               board, threads, depth, hash_size);
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <array>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "search_result.h"
+#include "search_limits.h"
+#include "simple_concurrent_search.h"
+#include "abdada_tt.h"
+#include "abdada_search.h"
+#include "simplified_abdada.h"
+#include "batch.h"
+
+constexpr int selfplay_max_plies = 300; // Games this long get adjudicated a draw
+
+/**
+ * One side of a match: algorithm:threads:hash:limit, where the limit per move is d<depth>, t<milliseconds> or
+ * n<nodes>, e.g. "abdada:8:1024:t500".
+ */
+struct Player_Config {
+    std::string algorithm = "abdada";
+    std::size_t threads = 1;
+    std::size_t hash_size = 256; // MB
+    Search_Limits limits = Search_Limits::to_depth(8);
+    std::string name;
+
+    static Player_Config parse(const std::string& description) {
+        Player_Config config;
+        config.name = description;
+        std::istringstream parts(description);
+        std::string part;
+        for (int i = 0; std::getline(parts, part, ':'); i++) {
+            if (part.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                config.algorithm = part;
+            } else if (i == 1) {
+                config.threads = std::max(std::stoul(part), 1ul);
+            } else if (i == 2) {
+                config.hash_size = std::max(std::stoul(part), 1ul);
+            } else if (i == 3 && part.size() > 1) {
+                uint64_t value = std::stoull(part.substr(1));
+                config.limits = Search_Limits{};
+                if (part[0] == 'd') {
+                    config.limits.depth = std::clamp<int>((int) value, 1, max_search_depth);
+                } else if (part[0] == 't') {
+                    config.limits.time = std::chrono::milliseconds(value);
+                } else if (part[0] == 'n') {
+                    config.limits.nodes = value;
+                }
+            }
+        }
+        return config;
+    }
+};
+
+/**
+ * What one side measured over a match.
+ */
+struct Player_Stats {
+    uint64_t moves = 0;
+    uint64_t nodes = 0;
+    double time = 0;
+    std::array<double, max_search_depth + 1> time_to_depth{}; // Summed over the moves that completed the depth
+    std::array<uint64_t, max_search_depth + 1> reached{}; // Number of moves that completed the depth
+
+    void record(const Timed_Result& result, double move_time) {
+        moves++;
+        nodes += result.nodes;
+        time += move_time;
+        for (int depth = 1; depth <= result.depth; depth++) {
+            time_to_depth[depth] += result.time_to_depth[depth];
+            reached[depth]++;
+        }
+    }
+
+    void print(const std::string& name) const {
+        std::cout << name << ": " << moves << " moves, " << (moves ? nodes / moves : 0) << " nodes per move, "
+                  << (uint64_t) (time > 0 ? nodes / time : 0) << " nps, average time to depth";
+        for (int depth = 1; depth <= max_search_depth && reached[depth] > 0; depth++) {
+            std::cout << " " << depth << ":" << time_to_depth[depth] / reached[depth];
+        }
+        std::cout << std::endl;
+    }
+};
+
+class Match_Player {
+
+public:
+    virtual ~Match_Player() = default;
+
+    virtual Timed_Result think(Board& board, uint64_t seed) = 0;
+
+    virtual void new_game() = 0;
+};
+
+/**
+ * Keeps its TT for the whole game: each move only ages it, so the search starts from what the previous moves left
+ * there, like it would in a real game. Only a new game clears it.
+ */
+template<class Transposition_Table, class Search>
+class Search_Player : public Match_Player {
+
+private:
+    Transposition_Table tt;
+    std::size_t threads;
+    Search_Limits limits;
+
+public:
+    explicit Search_Player(const Player_Config& config) : tt(config.hash_size), threads(config.threads),
+                                                         limits(config.limits) {
+    }
+
+    Timed_Result think(Board& board, uint64_t seed) override {
+        tt.new_search();
+        Search search(threads, board, tt);
+        search.set_seed(seed);
+        return search.template parallel_search<Timed_Result, true>(limits);
+    }
+
+    void new_game() override {
+        tt.clear();
+    }
+};
+
+inline std::unique_ptr<Match_Player> make_player(const Player_Config& config) {
+    if (config.algorithm == "lazy") {
+        return std::make_unique<Search_Player<Locking_TT<REPLACE_LAST_ENTRY>, Lazy_SMP<true, REPLACE_LAST_ENTRY>>>(config);
+    } else if (config.algorithm == "simple-abdada") {
+        return std::make_unique<Search_Player<Locking_TT<REPLACE_LAST_ENTRY>,
+                                              Simplified_ABDADA_Search<true, REPLACE_LAST_ENTRY>>>(config);
+    }
+    return std::make_unique<Search_Player<ABDADA_TT<REPLACE_LAST_ENTRY>, ABDADA_Search<true, REPLACE_LAST_ENTRY>>>(config);
+}
+
+/**
+ * @return 1 if white won, 0 if black won, 0.5 for a draw. Draws are stalemate, threefold repetition and games longer
+ * than selfplay_max_plies.
+ */
+inline double play_game(Board board, Match_Player& white, Match_Player& black, Player_Stats& white_stats,
+                        Player_Stats& black_stats, uint64_t game) {
+    white.new_game();
+    black.new_game();
+    std::map<uint64_t, int> seen; // Positions of the game so far, for repetitions
+    for (int ply = 0; ply < selfplay_max_plies; ply++) {
+        if (++seen[board.hashKey] == 3) {
+            return 0.5;
+        }
+        Movelist moves;
+        Movegen::legalmoves<ALL>(board, moves);
+        Color us = board.sideToMove, them = us == White ? Black : White;
+        if (moves.size == 0) {
+            if (!board.isSquareAttacked(them, board.KingSQ(us))) {
+                return 0.5;
+            }
+            return us == White ? 0 : 1;
+        }
+        Match_Player& player = us == White ? white : black;
+        auto start = std::chrono::steady_clock::now();
+        Timed_Result result = player.think(board, game * selfplay_max_plies + ply);
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+        (us == White ? white_stats : black_stats).record(result, time.count());
+        std::cout << "game " << game << " ply " << ply << " " << convertMoveToUci(result.move) << " eval " << result.eval
+                  << " depth " << result.depth << " nodes " << result.nodes << " time " << time.count() << " nps "
+                  << (uint64_t) (result.nodes / time.count()) << " time to depth";
+        for (int depth = 1; depth <= result.depth; depth++) {
+            std::cout << " " << result.time_to_depth[depth];
+        }
+        std::cout << std::endl;
+        if (moves.find(result.move) < 0) { // A search that was halted before completing depth 1
+            return us == White ? 0 : 1;
+        }
+        board.makeMove(result.move);
+    }
+    return 0.5;
+}
+
+/**
+ * Plays every opening twice, once with each side as white, and reports the score of a, the game flow measurements of
+ * both sides, and the result of each game as it finishes.
+ */
+inline void run_match(std::istream& openings, const Player_Config& a, const Player_Config& b) {
+    auto player_a = make_player(a);
+    auto player_b = make_player(b);
+    Player_Stats stats_a, stats_b;
+    double score_a = 0;
+    uint64_t games = 0;
+    Batch_Position opening;
+    while (read_position(openings, opening)) {
+        for (int a_is_white = 1; a_is_white >= 0; a_is_white--) {
+            Board board;
+            board.applyFen(opening.fen);
+            double white_score = a_is_white ? play_game(board, *player_a, *player_b, stats_a, stats_b, games)
+                                            : play_game(board, *player_b, *player_a, stats_b, stats_a, games);
+            double game_score_a = a_is_white ? white_score : 1 - white_score;
+            score_a += game_score_a;
+            games++;
+            std::cout << "game " << games - 1 << " opening " << opening.index << " " << (a_is_white ? a.name : b.name)
+                      << " vs " << (a_is_white ? b.name : a.name) << " result "
+                      << (white_score == 1 ? "1-0" : white_score == 0 ? "0-1" : "1/2-1/2") << ", score " << score_a
+                      << "/" << games << " for " << a.name << std::endl;
+        }
+    }
+    stats_a.print(a.name);
+    stats_b.print(b.name);
+}
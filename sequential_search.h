@@ -2,6 +2,9 @@
 
 #include "chess.hpp"
 #include "transposition_table.h"
+#include "move_picker.h"
+#include "see.h"
+#include "selective.h"
 
 template<bool Q_SEARCH, TT_Strategy strategy>
 class Search {
@@ -10,6 +13,7 @@ private:
     Board board;
     uint64_t nodes = 0;
     Transposition_Table<strategy>& tt;
+    Move_Order order;
 
     /**
      *
@@ -70,9 +74,14 @@ public:
             alpha = q_eval;
         }
 
+        Eval_Type stand_pat = q_eval;
         Movelist captures;
-        Movegen::legalmoves<CAPTURE>(board, captures);
+        generate_moves<CAPTURE>(board, captures);
+        order_captures(board, captures);
         for (auto& capture : captures) {
+            if (prune_capture(board, capture.move, stand_pat, alpha)) {
+                continue;
+            }
             board.makeMove(capture.move);
             Eval_Type inner_eval = -q_search(-beta, -alpha);
             board.unmakeMove(capture.move);
@@ -104,9 +113,14 @@ public:
             return q_eval;
         }
 
+        Eval_Type stand_pat = q_eval;
         Movelist captures;
-        Movegen::legalmoves<CAPTURE>(board, captures);
+        generate_moves<CAPTURE>(board, captures);
+        order_captures(board, captures);
         for (auto& capture : captures) {
+            if (prune_capture(board, capture.move, stand_pat, beta - 1)) {
+                continue;
+            }
             board.makeMove(capture.move);
             Eval_Type inner_eval = -nw_q_search(-beta + 1);
             board.unmakeMove(capture.move);
@@ -130,27 +144,50 @@ public:
         }
 
         TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
-        Movelist moves;
-        Movegen::legalmoves<ALL>(board, moves);
-        int tt_move_index = moves.find(tt_move);
-        if (tt_move_index > 0) {
-            std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
+        Selectivity selectivity(board, beta, depth);
+        if (selectivity.null_move()) {
+            int null_depth = depth - 1 - null_move_reduction;
+            board.makeNullMove();
+            Eval_Type null_eval = null_depth > 0 ? -null_window_search(-beta + 1, null_depth) : -nw_q_search(-beta + 1);
+            board.unmakeNullMove();
+            if (null_eval >= beta) {
+                entry.eval = null_eval;
+                entry.type = LOWER_BOUND;
+                tt.emplace(board.hashKey, entry, depth);
+                return null_eval;
+            }
         }
-        for (auto& move : moves) {
-            board.makeMove(move.move);
+
+        Move_Picker moves(board, tt_move, nullptr, &order, depth);
+        int move_index = 0;
+        for (Move move = moves.next(); move != NO_MOVE; move = moves.next(), move_index++) {
+            bool quiet = !is_capture(board, move);
+            board.makeMove(move);
+            if (selectivity.skip(board, quiet, move_index)) {
+                board.unmakeMove(move);
+                eval = std::max(eval, selectivity.futility_bound(depth));
+                continue;
+            }
+            int reduction = selectivity.reduction(board, quiet, move_index, depth);
             Eval_Type inner_eval;
-            if (depth > 1) {
+            if (reduction > 0) {
+                inner_eval = -null_window_search(-beta + 1, depth - 1 - reduction);
+                if (inner_eval >= beta) { // Verify at full depth
+                    inner_eval = -null_window_search(-beta + 1, depth - 1);
+                }
+            } else if (depth > 1) {
                 inner_eval = -null_window_search(-beta + 1, depth - 1);
             } else {
                 inner_eval = -nw_q_search(-beta + 1);
             }
-            board.unmakeMove(move.move);
+            board.unmakeMove(move);
 
             if (inner_eval > eval) {
                 eval = inner_eval;
-                entry.move = move.move;
+                entry.move = move;
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
             }
@@ -168,16 +205,11 @@ public:
         }
 
         TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
-        Movelist moves;
-        Movegen::legalmoves<ALL>(board, moves);
-        int tt_move_index = moves.find(tt_move);
-        if (tt_move_index > 0) {
-            std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
-        }
+        Move_Picker moves(board, tt_move, nullptr, &order, depth);
 
         bool search_full_window = true;
-        for (auto& move : moves) {
-            board.makeMove(move.move);
+        for (Move move = moves.next(); move != NO_MOVE; move = moves.next()) {
+            board.makeMove(move);
             Eval_Type inner_eval;
             if (depth == 1) {
                 inner_eval = -q_search(-beta, -alpha);
@@ -185,13 +217,14 @@ public:
                 inner_eval = -pv_search(-beta, -alpha, depth - 1);
                 search_full_window = false;
             }
-            board.unmakeMove(move.move);
+            board.unmakeMove(move);
 
             if (inner_eval > eval) {
                 eval = inner_eval;
-                entry.move = move.move; // If it stays this way, this is the best move
+                entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
                 if (eval > alpha) {
@@ -215,7 +248,7 @@ public:
 
         TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
         Movelist moves;
-        Movegen::legalmoves<ALL>(board, moves);
+        generate_moves<ALL>(board, moves);
 
         for (auto& move : moves) {
             board.makeMove(move.move);
@@ -250,6 +283,7 @@ public:
     Search_Result root_max(Eval_Type alpha, Eval_Type beta, int depth, Search_Result& result) {
         auto start = std::chrono::high_resolution_clock::now();
         nodes = 0;
+        order.new_iteration();
         assert(depth > 0);
         Eval_Type eval = MIN_EVAL;
         Move tt_move = NO_MOVE;
@@ -258,7 +292,7 @@ public:
         }
 
         Movelist moves;
-        Movegen::legalmoves<ALL>(board, moves);
+        generate_moves<ALL>(board, moves);
         int tt_move_index = moves.find(tt_move);
         if (tt_move_index > 0) {
             std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
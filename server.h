@@ -0,0 +1,469 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <csignal>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "search_result.h"
+#include "search_limits.h"
+#include "simple_concurrent_search.h"
+#include "abdada_tt.h"
+#include "abdada_search.h"
+#include "simplified_abdada.h"
+
+constexpr std::size_t server_default_hash = 4096; // MB per kind of TT
+constexpr int server_default_depth = 10; // For requests without any limit
+constexpr std::chrono::milliseconds server_report_interval{1000};
+
+/**
+ * Parses one flat JSON object, i.e. without nested objects or arrays, which is all the requests need. Values end up as
+ * their text: strings without quotes and escapes, numbers and literals as written.
+ * @return false if the line is no such object.
+ */
+inline bool parse_json_object(const std::string& line, std::map<std::string, std::string>& fields) {
+    std::size_t i = 0;
+    auto skip_spaces = [&]() {
+        while (i < line.size() && std::isspace((unsigned char) line[i])) {
+            i++;
+        }
+    };
+    auto parse_string = [&](std::string& string) {
+        if (line[i] != '"') {
+            return false;
+        }
+        for (i++; i < line.size() && line[i] != '"'; i++) {
+            if (line[i] == '\\' && ++i < line.size()) {
+                char escaped = line[i];
+                string += escaped == 'n' ? '\n' : escaped == 't' ? '\t' : escaped;
+            } else {
+                string += line[i];
+            }
+        }
+        return i++ < line.size();
+    };
+    skip_spaces();
+    if (i >= line.size() || line[i++] != '{') {
+        return false;
+    }
+    skip_spaces();
+    while (i < line.size() && line[i] != '}') {
+        std::string key, value;
+        if (!parse_string(key)) {
+            return false;
+        }
+        skip_spaces();
+        if (i >= line.size() || line[i++] != ':') {
+            return false;
+        }
+        skip_spaces();
+        if (i < line.size() && line[i] == '"') {
+            if (!parse_string(value)) {
+                return false;
+            }
+        } else {
+            while (i < line.size() && line[i] != ',' && line[i] != '}' && !std::isspace((unsigned char) line[i])) {
+                value += line[i++];
+            }
+        }
+        fields[key] = value;
+        skip_spaces();
+        if (i < line.size() && line[i] == ',') {
+            i++;
+            skip_spaces();
+        }
+    }
+    return i < line.size();
+}
+
+inline std::string json_string(const std::string& string) {
+    std::string quoted = "\"";
+    for (char c : string) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c == '\n' ? ' ' : c;
+    }
+    return quoted + "\"";
+}
+
+/**
+ * One side of the server's conversations, either stdin/stdout or a socket connection. Results of several searches
+ * arrive concurrently, so sending takes a lock to keep lines whole.
+ */
+class Server_Client {
+
+private:
+    int in;
+    int out;
+    std::mutex mutex;
+    std::string buffer;
+
+public:
+    Server_Client(int in, int out) : in(in), out(out) {
+    }
+
+    Server_Client(const Server_Client&) = delete;
+    Server_Client& operator=(const Server_Client&) = delete;
+
+    ~Server_Client() {
+        if (in != STDIN_FILENO) { // A socket, in and out are the same descriptor
+            close(in);
+        }
+    }
+
+    /**
+     * Blocks until a whole line arrived. Only the reader thread of the client calls this.
+     * @return false once the client closed its side.
+     */
+    bool read_line(std::string& line) {
+        while (true) {
+            if (auto end = buffer.find('\n'); end != std::string::npos) {
+                line = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                return true;
+            }
+            char chunk[4096];
+            ssize_t bytes = read(in, chunk, sizeof(chunk));
+            if (bytes <= 0) {
+                return false;
+            }
+            buffer.append(chunk, bytes);
+        }
+    }
+
+    /**
+     * Drops the line if the client is gone, its searches still run to completion.
+     */
+    void send(const std::string& line) {
+        std::lock_guard<std::mutex> guard(mutex);
+        std::string message = line + "\n";
+        for (std::size_t sent = 0; sent < message.size();) {
+            ssize_t bytes = write(out, message.data() + sent, message.size() - sent);
+            if (bytes <= 0) {
+                return;
+            }
+            sent += bytes;
+        }
+    }
+};
+
+struct Analysis_Request {
+    std::string id;
+    std::string fen;
+    std::string algorithm = "abdada";
+    Search_Limits limits;
+    int priority = 1; // At least 1, a request gets free cores in proportion to its priority
+    std::size_t threads = 0; // 0 lets the server decide
+    uint64_t ticket = 0; // Order of arrival, breaks priority ties and seeds the search
+    std::shared_ptr<Server_Client> client;
+};
+
+/**
+ * The searches call print_table after every iteration, the server only sends the final result and the periodic
+ * progress reports.
+ */
+struct Server_Result : Search_Result {
+    void print_table(int, int) const {
+    }
+};
+
+/**
+ * Runs analysis requests from any number of clients on one pool of cores, with one TT per kind of TT the searches use,
+ * allocated on first use and shared by all searches of that kind. Requests and results are newline delimited JSON:
+ *
+ * {"id": "a", "fen": "...", "depth": 12, "nodes": 0, "movetime": 0, "infinite": false, "algorithm": "abdada",
+ *  "priority": 1, "threads": 0}
+ * {"cmd": "stop", "id": "a"}
+ *
+ * Only id and fen are required. Each running search sends an "info" object every server_report_interval and a
+ * "result" object once it is done, or an "error" object if the request was broken.
+ *
+ * Scheduling: requests wait until there are free cores, the highest priority first and in order of arrival among
+ * equal priorities. A request gets the cores it asked for if they are free, otherwise a share of the free cores in
+ * proportion to its priority among all waiting requests. Running searches keep their threads, so nobody gets more than
+ * max_threads_per_request, to leave some cores for whatever comes next.
+ */
+class Analysis_Server {
+
+private:
+    struct Running_Search {
+        std::string id;
+        std::shared_ptr<Server_Client> client;
+        std::function<void()> halt;
+        std::thread thread;
+    };
+
+    std::size_t total_threads;
+    std::size_t max_threads_per_request;
+    std::size_t hash_size;
+    std::unique_ptr<Locking_TT<REPLACE_LAST_ENTRY>> locking_tt;
+    std::unique_ptr<ABDADA_TT<REPLACE_LAST_ENTRY>> abdada_tt;
+
+    std::mutex mutex; // Guards everything below
+    std::condition_variable wake_up;
+    std::size_t free_cores;
+    std::list<Analysis_Request> pending;
+    std::map<uint64_t, Running_Search> running; // By ticket
+    std::vector<uint64_t> finished; // Tickets of searches that are done, their threads can be joined
+    uint64_t next_ticket = 0;
+    bool draining = false;
+
+    static void send_error(Server_Client& client, const std::string& id, const std::string& message) {
+        client.send("{\"id\": " + json_string(id) + ", \"type\": \"error\", \"message\": " + json_string(message) + "}");
+    }
+
+    /**
+     * Call with the lock held.
+     */
+    std::size_t threads_for(const Analysis_Request& request) const {
+        std::size_t threads = request.threads;
+        if (threads == 0) {
+            int priorities = 0;
+            for (auto& waiting : pending) {
+                priorities += waiting.priority;
+            }
+            threads = free_cores * request.priority / priorities;
+        }
+        return std::clamp<std::size_t>(threads, 1, std::min(free_cores, max_threads_per_request));
+    }
+
+    template<class Search, class Transposition_Table>
+    void launch(Analysis_Request request, Transposition_Table& tt, std::size_t threads) {
+        Board board;
+        board.applyFen(request.fen);
+        auto search = std::make_shared<Search>(threads, board, tt);
+        search->set_seed(request.ticket);
+        auto client = request.client;
+        std::string id = json_string(request.id);
+        search->set_reporting(server_report_interval, [client, id](const Search_Progress& progress) {
+            std::ostringstream line;
+            line << "{\"id\": " << id << ", \"type\": \"info\", \"depth\": " << progress.depth << ", \"nodes\": "
+                 << progress.nodes << ", \"nps\": " << (uint64_t) progress.nps << ", \"time\": "
+                 << (uint64_t) (progress.time * 1000) << ", \"move\": \"" << convertMoveToUci(progress.best_move)
+                 << "\", \"eval\": " << progress.eval << "}";
+            client->send(line.str());
+        });
+        Running_Search& entry = running[request.ticket];
+        entry.id = request.id;
+        entry.client = client;
+        entry.halt = [search]() { search->halt(); };
+        entry.thread = std::thread([this, search, request, threads, id]() {
+            auto start = std::chrono::steady_clock::now();
+            Server_Result result = search->template parallel_search<Server_Result, true>(request.limits);
+            std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+            std::ostringstream line;
+            line << "{\"id\": " << id << ", \"type\": \"result\", \"move\": \"" << convertMoveToUci(result.move)
+                 << "\", \"eval\": " << result.eval << ", \"depth\": " << result.depth << ", \"nodes\": "
+                 << result.nodes << ", \"time\": " << (uint64_t) (time.count() * 1000) << ", \"threads\": " << threads
+                 << "}";
+            request.client->send(line.str());
+            std::lock_guard<std::mutex> guard(mutex);
+            free_cores += threads;
+            finished.push_back(request.ticket);
+            wake_up.notify_all();
+        });
+    }
+
+    /**
+     * Call with the lock held.
+     */
+    void start(Analysis_Request request, std::size_t threads) {
+        free_cores -= threads;
+        if (request.algorithm == "lazy" || request.algorithm == "simple-abdada") {
+            if (!locking_tt) {
+                locking_tt = std::make_unique<Locking_TT<REPLACE_LAST_ENTRY>>(hash_size);
+            }
+            if (request.algorithm == "lazy") {
+                launch<Lazy_SMP<true, REPLACE_LAST_ENTRY>>(std::move(request), *locking_tt, threads);
+            } else {
+                launch<Simplified_ABDADA_Search<true, REPLACE_LAST_ENTRY>>(std::move(request), *locking_tt, threads);
+            }
+        } else {
+            if (!abdada_tt) {
+                abdada_tt = std::make_unique<ABDADA_TT<REPLACE_LAST_ENTRY>>(hash_size);
+            }
+            launch<ABDADA_Search<true, REPLACE_LAST_ENTRY>>(std::move(request), *abdada_tt, threads);
+        }
+    }
+
+    /**
+     * Call with the lock held. The threads only take the lock once they sent their result, so joining is quick.
+     */
+    void join_finished() {
+        for (uint64_t ticket : finished) {
+            running[ticket].thread.join();
+            running.erase(ticket);
+        }
+        finished.clear();
+    }
+
+    void stop(const std::shared_ptr<Server_Client>& client, const std::string& id) {
+        std::lock_guard<std::mutex> guard(mutex);
+        for (auto request = pending.begin(); request != pending.end(); request++) {
+            if (request->client == client && request->id == id) {
+                send_error(*client, id, "stopped before it started");
+                pending.erase(request);
+                return;
+            }
+        }
+        for (auto& [ticket, search] : running) {
+            if (search.client == client && search.id == id) {
+                search.halt(); // The search sends its result as usual
+            }
+        }
+    }
+
+    void submit(const std::shared_ptr<Server_Client>& client, const std::string& line) {
+        std::map<std::string, std::string> fields;
+        if (!parse_json_object(line, fields)) {
+            send_error(*client, "", "not a flat JSON object: " + line);
+            return;
+        }
+        if (fields["cmd"] == "stop") {
+            stop(client, fields["id"]);
+            return;
+        }
+        Analysis_Request request;
+        request.id = fields["id"];
+        request.fen = fields["fen"];
+        request.client = client;
+        try {
+            if (!fields["algorithm"].empty()) {
+                request.algorithm = fields["algorithm"];
+            }
+            request.limits.depth = fields["depth"].empty() ? max_search_depth
+                                                           : std::clamp(std::stoi(fields["depth"]), 1, max_search_depth);
+            request.limits.nodes = fields["nodes"].empty() ? 0 : std::stoull(fields["nodes"]);
+            request.limits.time = std::chrono::milliseconds(fields["movetime"].empty() ? 0 : std::stoll(fields["movetime"]));
+            request.limits.infinite = fields["infinite"] == "true";
+            request.priority = fields["priority"].empty() ? 1 : std::max(std::stoi(fields["priority"]), 1);
+            request.threads = fields["threads"].empty() ? 0 : std::stoul(fields["threads"]);
+        } catch (const std::exception&) {
+            send_error(*client, request.id, "malformed number");
+            return;
+        }
+        if (request.fen.empty()) {
+            send_error(*client, request.id, "missing fen");
+            return;
+        }
+        if (fields["depth"].empty() && request.limits.nodes == 0 && request.limits.time.count() == 0
+            && !request.limits.infinite) {
+            request.limits.depth = server_default_depth;
+        }
+        std::lock_guard<std::mutex> guard(mutex);
+        request.ticket = next_ticket++;
+        pending.push_back(std::move(request));
+        wake_up.notify_all();
+    }
+
+public:
+    Analysis_Server(std::size_t total_threads, std::size_t hash_size) : total_threads(std::max<std::size_t>(total_threads, 1)),
+            max_threads_per_request(std::max<std::size_t>(total_threads / 2, 1)), hash_size(hash_size),
+            free_cores(this->total_threads) {
+    }
+
+    /**
+     * Reads requests of one client until it closes its side. Any number of clients can be served at once, each from
+     * a thread of its own.
+     */
+    void serve(const std::shared_ptr<Server_Client>& client) {
+        std::string line;
+        while (client->read_line(line)) {
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                submit(client, line);
+            }
+        }
+    }
+
+    /**
+     * Starts waiting requests as cores free up, until drain got called and everything is done.
+     */
+    void dispatch() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake_up.wait(lock, [this]() {
+                return !finished.empty() || (!pending.empty() && free_cores > 0) || (draining && running.empty());
+            });
+            join_finished();
+            if (pending.empty()) {
+                if (draining && running.empty()) {
+                    return;
+                }
+                continue;
+            }
+            if (free_cores == 0) {
+                continue;
+            }
+            auto next = std::min_element(pending.begin(), pending.end(), [](auto& a, auto& b) {
+                return a.priority != b.priority ? a.priority > b.priority : a.ticket < b.ticket;
+            });
+            std::size_t threads = threads_for(*next);
+            Analysis_Request request = std::move(*next);
+            pending.erase(next);
+            start(std::move(request), threads);
+        }
+    }
+
+    /**
+     * Lets dispatch return once all requests got answered.
+     */
+    void drain() {
+        std::lock_guard<std::mutex> guard(mutex);
+        draining = true;
+        wake_up.notify_all();
+    }
+};
+
+/**
+ * Serves stdin/stdout until stdin ends, then finishes the requests it got.
+ */
+inline void run_server(std::size_t total_threads, std::size_t hash_size) {
+    Analysis_Server server(total_threads, hash_size);
+    std::thread dispatcher(&Analysis_Server::dispatch, &server);
+    server.serve(std::make_shared<Server_Client>(STDIN_FILENO, STDOUT_FILENO));
+    server.drain();
+    dispatcher.join();
+}
+
+/**
+ * Serves every connection to a Unix socket at path, until the process gets killed.
+ */
+inline void run_server(std::size_t total_threads, std::size_t hash_size, const std::string& path) {
+    std::signal(SIGPIPE, SIG_IGN); // A client that hung up makes write fail instead of killing the server
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Cannot create socket " << path << std::endl;
+        return;
+    }
+    path.copy(address.sun_path, path.size());
+    unlink(path.c_str());
+    if (bind(listener, (sockaddr*) &address, sizeof(address)) < 0 || listen(listener, 16) < 0) {
+        std::cerr << "Cannot listen on " << path << std::endl;
+        close(listener);
+        return;
+    }
+    Analysis_Server server(total_threads, hash_size);
+    std::thread dispatcher(&Analysis_Server::dispatch, &server);
+    while (true) {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            continue;
+        }
+        std::thread(&Analysis_Server::serve, &server, std::make_shared<Server_Client>(connection, connection)).detach();
+    }
+}
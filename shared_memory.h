@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "chess.hpp"
+
+static_assert(std::atomic<bool>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "The locks and flags in a shared segment must be lock free to work across processes");
+
+constexpr uint64_t segment_magic = 0x5047545f53484d31; // "PGT_SHM1"
+
+/**
+ * The start of a shared segment, through which the processes searching on it coordinate. Everything is zero in a new
+ * segment, which is also the valid initial state of every field and of every TT entry after it.
+ */
+struct alignas(64) Segment_Header {
+    uint64_t magic;
+    uint64_t table_bytes;
+    std::atomic<bool> stop; // Set once the search is done, every process halts its own search when it sees it
+    std::atomic<uint32_t> attached; // Processes that joined the search
+    std::atomic<uint32_t> finished; // Processes whose search returned
+
+    /**
+     * The result gets claimed by the first process completing the search: it alone writes move, eval and depth, then
+     * publishes them through result_ready.
+     */
+    std::atomic<bool> claimed;
+    std::atomic<bool> result_ready;
+    Move move;
+    Eval_Type eval;
+    int32_t depth;
+    std::atomic<uint64_t> nodes; // Of the last iteration, summed over all processes
+};
+
+/**
+ * A POSIX shared memory segment holding a Segment_Header followed by a TT, see the TT constructors taking one. The
+ * process that creates the segment also removes its name again once it is done with it; processes that attach to it
+ * by name, which can be different builds, only unmap it.
+ *
+ * The TTs work in it unchanged: their bucket locks are lock free atomics, which work across processes, and so does the
+ * ABDADA proc count protocol, which only happens under those locks. What does not work across processes is a process
+ * dying while it holds a bucket lock, which would block that bucket for everyone. The lock is only ever held for a
+ * handful of instructions, so we accept that.
+ */
+class Shared_Segment {
+
+private:
+    std::string name;
+    bool owner;
+    std::size_t bytes = 0;
+    void* memory = nullptr;
+
+public:
+    /**
+     * @param name A POSIX shared memory name, i.e. starting with a slash.
+     * @param size_in_mb Size of the TT in it when creating the segment, rounded down to a power of two like the TTs do.
+     * 0 attaches to an existing segment instead.
+     */
+    Shared_Segment(std::string name, uint64_t size_in_mb) : name(std::move(name)), owner(size_in_mb > 0) {
+        int descriptor = shm_open(this->name.c_str(), owner ? O_CREAT | O_EXCL | O_RDWR : O_RDWR, 0600);
+        if (descriptor < 0) {
+            std::cerr << "Cannot " << (owner ? "create" : "open") << " shared memory " << this->name << ": "
+                      << std::strerror(errno) << std::endl;
+            owner = false; // Whoever made the segment of that name will remove it
+            return;
+        }
+        if (owner) {
+            bytes = sizeof(Segment_Header) + (1 << 20) * std::bit_floor(size_in_mb);
+            if (ftruncate(descriptor, (off_t) bytes) < 0) {
+                bytes = 0;
+            }
+        } else {
+            off_t end = lseek(descriptor, 0, SEEK_END);
+            bytes = end > 0 ? (std::size_t) end : 0;
+        }
+        if (bytes >= sizeof(Segment_Header)) {
+            memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+            if (memory == MAP_FAILED) {
+                memory = nullptr;
+            }
+        }
+        close(descriptor);
+        if (memory == nullptr) {
+            std::cerr << "Cannot map shared memory " << this->name << std::endl;
+            return;
+        }
+        if (owner) {
+            header().table_bytes = bytes - sizeof(Segment_Header);
+            header().magic = segment_magic;
+        } else if (header().magic != segment_magic || header().table_bytes != bytes - sizeof(Segment_Header)) {
+            std::cerr << "Shared memory " << this->name << " is no TT segment" << std::endl;
+            munmap(memory, bytes);
+            memory = nullptr;
+        }
+    }
+
+    Shared_Segment(const Shared_Segment&) = delete;
+    Shared_Segment& operator=(const Shared_Segment&) = delete;
+
+    ~Shared_Segment() {
+        if (memory != nullptr) {
+            munmap(memory, bytes);
+        }
+        if (owner) {
+            shm_unlink(name.c_str());
+        }
+    }
+
+    [[nodiscard]] bool is_mapped() const {
+        return memory != nullptr;
+    }
+
+    [[nodiscard]] Segment_Header& header() const {
+        return *static_cast<Segment_Header*>(memory);
+    }
+
+    [[nodiscard]] void* table_memory() const {
+        return static_cast<char*>(memory) + sizeof(Segment_Header);
+    }
+
+    [[nodiscard]] std::size_t table_bytes() const {
+        return memory == nullptr ? 0 : bytes - sizeof(Segment_Header);
+    }
+};
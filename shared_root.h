@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include "locking_tt.h"
+
+/**
+ * State of one iteration of a cooperative root search. Instead of every thread searching every root move in its own
+ * order, the root moves are generated once, every thread searches the first (TT) move to establish a bound, and after
+ * that threads claim the remaining moves one at a time. A thread that proves a better root score publishes it through
+ * alpha, so every thread starting a new root move picks up the best bound found so far.
+ * Once all moves are claimed, threads that ran out of work help with moves that are still being searched, the same way
+ * the independent root search has all threads search all moves.
+ * The independent root search only uses best move and eval, see record_best.
+ */
+struct Shared_Root {
+    static constexpr int max_moves = 256;
+
+    Movelist moves;
+    std::atomic<int> next_move = 1; // Move 0 gets searched by everyone, so claiming starts at 1
+    std::atomic<int> moves_done = 0;
+    std::atomic<Eval_Type> alpha = MIN_EVAL;
+    std::atomic<bool> done[max_moves] = {};
+
+    Spin_Lock lock; // Protects the best move and eval
+    Move best_move = NO_MOVE;
+    Eval_Type best_eval = MIN_EVAL;
+
+    /**
+     * @param previous The index of the root move the calling thread searched last.
+     * @return The index of the next root move to search, or moves.size if every root move is done.
+     */
+    int claim_move(int previous) {
+        int claimed = next_move.fetch_add(1);
+        if (claimed < moves.size) {
+            return claimed;
+        }
+        for (int i = 1; i <= moves.size; i++) { // Everything is claimed, help with a move that is not done yet
+            int index = (previous + i) % moves.size;
+            if (!done[index].load(std::memory_order_relaxed)) {
+                return index;
+            }
+        }
+        return moves.size;
+    }
+
+    /**
+     * Records the result of a completed root move. Only the first thread to complete a move gets to record it.
+     * @return true if this completed the last outstanding root move, i.e. the caller finishes the iteration.
+     */
+    bool complete_move(int index, Move move, Eval_Type eval) {
+        if (done[index].exchange(true)) {
+            return false;
+        }
+        {
+            std::lock_guard<Spin_Lock> guard(lock);
+            if (eval > best_eval) {
+                best_eval = eval;
+                best_move = move;
+            }
+        }
+        Eval_Type current = alpha.load();
+        while (eval > current && !alpha.compare_exchange_weak(current, eval)) {
+        } // Only ever raise the shared bound, compare_exchange reloads current on failure
+        return moves_done.fetch_add(1) + 1 == moves.size;
+    }
+
+    /**
+     * For the independent root search: each thread records its best move and eval after every root move it completes,
+     * so that a halted iteration can report the best of them instead of the result of the iteration before.
+     */
+    void record_best(Move move, Eval_Type eval) {
+        std::lock_guard<Spin_Lock> guard(lock);
+        if (eval > best_eval) {
+            best_eval = eval;
+            best_move = move;
+        }
+    }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "search_result.h"
+#include "search_limits.h"
+#include "shared_memory.h"
+#include "simple_concurrent_search.h"
+
+/**
+ * Lazy SMP across processes: this process runs a Lazy_SMP search with its threads on the TT in the segment, while
+ * other processes do the same. Like the threads within a Lazy SMP search, the processes only share the TT. The first
+ * process to finish its search claims the result in the segment and sets its stop flag; every other process sees the
+ * flag within limit_watch_interval and halts its own search.
+ * @param seed Has to differ between the processes, so that their threads search different move orders.
+ * @return The result of this process' own search. The result of the whole search is the one in the segment header,
+ * once all processes are finished.
+ */
+inline Timed_Result shared_lazy_search(Shared_Segment& segment, Board& board, std::size_t threads,
+                                       const Search_Limits& limits, uint64_t seed) {
+    Segment_Header& header = segment.header();
+    header.attached++;
+    Locking_TT<REPLACE_LAST_ENTRY> tt(segment);
+    Lazy_SMP<true, REPLACE_LAST_ENTRY> search(threads, board, tt);
+    search.set_seed(seed);
+
+    std::atomic<bool> done = false;
+    std::thread watcher([&]() {
+        while (!done.load(std::memory_order_relaxed)) {
+            if (header.stop.load(std::memory_order_acquire)) {
+                search.halt();
+                return;
+            }
+            std::this_thread::sleep_for(limit_watch_interval);
+        }
+    });
+    Timed_Result result = search.parallel_search<Timed_Result, true>(limits);
+    done = true;
+    watcher.join();
+
+    if (!header.claimed.exchange(true, std::memory_order_acq_rel)) { // We finished first
+        header.move = result.move;
+        header.eval = result.eval;
+        header.depth = result.depth;
+        header.result_ready.store(true, std::memory_order_release);
+        header.stop.store(true, std::memory_order_release);
+    }
+    header.nodes += result.nodes;
+    header.finished++;
+    return result;
+}
+
+/**
+ * Searches the start position to depth once with processes * threads threads in this process on a heap TT, and once
+ * with processes processes of threads threads each on a shared TT of the same size, and prints both.
+ */
+inline void run_shared_benchmark(std::size_t processes, std::size_t threads, int depth, uint64_t hash_size) {
+    Board board;
+    board.applyFen(DEFAULT_POS);
+    Search_Limits limits = Search_Limits::to_depth(depth);
+    auto print = [](const std::string& name, double time, uint64_t nodes, Move move, Eval_Type eval, int reached) {
+        std::cout << name << ": depth " << reached << " in " << time << " s, " << nodes << " nodes in the last iteration, "
+                  << (uint64_t) (nodes / time) << " nps, move " << convertMoveToUci(move) << " eval " << eval << std::endl;
+    };
+
+    {
+        Locking_TT<REPLACE_LAST_ENTRY> tt(hash_size);
+        Lazy_SMP<true, REPLACE_LAST_ENTRY> search(processes * threads, board, tt);
+        auto start = std::chrono::steady_clock::now();
+        Timed_Result result = search.parallel_search<Timed_Result, true>(limits);
+        std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+        print("threads   " + std::to_string(processes * threads), time.count(), result.nodes, result.move, result.eval,
+              result.depth);
+    }
+
+    Shared_Segment segment("/parallel_gametree_search_" + std::to_string(getpid()), hash_size);
+    if (!segment.is_mapped()) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<pid_t> children;
+    for (std::size_t process = 1; process < processes; process++) {
+        pid_t child = fork(); // No threads run at this point, so the children start in a consistent state
+        if (child == 0) {
+            shared_lazy_search(segment, board, threads, limits, process);
+            _exit(0); // The parent owns the segment, so no destructors here
+        } else if (child > 0) {
+            children.push_back(child);
+        }
+    }
+    shared_lazy_search(segment, board, threads, limits, 0);
+    for (pid_t child : children) {
+        waitpid(child, nullptr, 0);
+    }
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    Segment_Header& header = segment.header();
+    print("processes " + std::to_string(header.finished.load()) + "x" + std::to_string(threads), time.count(),
+          header.nodes, header.move, header.eval, header.depth);
+}
+
+/**
+ * Joins the search on the segment of the given name, creating it if hash_size is not 0. Start one process with a hash
+ * size first and then any number without, e.g. of different builds; each prints the common result once it is done.
+ */
+inline void run_shared_search(const std::string& name, std::size_t threads, int depth, uint64_t hash_size) {
+    Shared_Segment segment(name, hash_size);
+    if (!segment.is_mapped()) {
+        return;
+    }
+    Board board;
+    board.applyFen(DEFAULT_POS);
+    auto start = std::chrono::steady_clock::now();
+    shared_lazy_search(segment, board, threads, Search_Limits::to_depth(depth), getpid());
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    Segment_Header& header = segment.header();
+    while (!header.result_ready.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_for(limit_watch_interval);
+    }
+    std::cout << "depth " << header.depth << " move " << convertMoveToUci(header.move) << " eval " << header.eval
+              << " after " << time.count() << " s, " << header.attached.load() << " processes joined" << std::endl;
+}
@@ -2,7 +2,17 @@
 
 #include <thread>
 #include <functional>
+#include <optional>
 #include "locking_tt.h"
+#include "shared_root.h"
+#include "load_balance.h"
+#include "alloc_counter.h"
+#include "move_picker.h"
+#include "see.h"
+#include "selective.h"
+#include "stop_signal.h"
+#include "live_stats.h"
+#include "search_limits.h"
 
 
 template<bool Q_SEARCH, TT_Strategy strategy>
@@ -12,7 +22,10 @@ private:
     Board board;
     uint64_t nodes = 0;
     Locking_TT<strategy>& tt;
-    std::atomic<bool>& finished;
+    Stop_Signal& finished;
+    Stop_Poll stop_poll; // Interior nodes check finished through this, only the root reads it directly
+    Counter_RNG rng; // Random move order of this thread, see move_order_rng
+    Move_Order order; // Killers and history of this thread, see MOVE_ORDERING
 
     /**
      *
@@ -52,26 +65,49 @@ private:
         return false;
     }
 
+    /**
+     * Generates the moves in a random order. With LAZY_SHUFFLE only the first move is chosen here, the others when the
+     * search gets to them through pick_move, so a node that cuts off early skips most of the shuffle. Nodes below
+     * SHUFFLE_DEPTH keep the generation order.
+     */
     template<Movetype TYPE>
-    void generate_shuffled_moves(Movelist& moves) {
-        Movegen::legalmoves<TYPE>(board, moves);
-        thread_local static std::mt19937 mt(seed);
-
-        for (int i = 0; i < moves.size; i++) {
-            // Get a random index of the array past the current index.
-            // ... The argument is an exclusive bound.
-            //     It will not go past the array's end.
-            int randomValue = i + (mt() % (moves.size - i)); // One could get rid of this mod but it doesn't appear to be a slowdown currently
-            // Swap the random element with the present element.
-            auto randomElement = moves[randomValue];
-            moves[randomValue] = moves[i];
-            moves[i] = randomElement;
+    void generate_shuffled_moves(Movelist& moves, int depth) {
+        generate_moves<TYPE>(board, moves);
+        if (depth < SHUFFLE_DEPTH) {
+            return;
+        }
+        int shuffled = LAZY_SHUFFLE ? std::min(1, (int) moves.size) : moves.size;
+        for (int i = 0; i < shuffled; i++) {
+            shuffle_step(moves, i, rng);
+        }
+    }
+
+    /**
+     * @return The move at index, which with LAZY_SHUFFLE gets chosen now. Call this with increasing indices, and only
+     * once per index; the moves before index are already searched and stay where they are.
+     */
+    Move pick_move(Movelist& moves, int index, int depth) {
+        if (LAZY_SHUFFLE && index > 0 && depth >= SHUFFLE_DEPTH) { // Move 0 is chosen at generation, or the TT move
+            shuffle_step(moves, index, rng);
         }
+        return moves[index].move;
     }
 
 public:
-    explicit Search_Thread(Board& board, Locking_TT<strategy>& table, std::atomic<bool>& finished)
-                                    : board(board), tt(table), finished(finished) {
+    explicit Search_Thread(Board& board, Locking_TT<strategy>& table, Stop_Signal& finished)
+                                    : board(board), tt(table), finished(finished), stop_poll(finished) {
+    }
+
+    void set_live_nodes(std::atomic<uint64_t>& counter) {
+        stop_poll.publish_to(counter);
+    }
+
+    void set_rng(const Counter_RNG& stream) {
+        rng = stream;
+    }
+
+    [[nodiscard]] uint64_t get_nodes() const {
+        return nodes;
     }
 
     Eval_Type q_search(Eval_Type alpha, Eval_Type beta) {
@@ -91,9 +127,14 @@ public:
             alpha = q_eval;
         }
 
+        Eval_Type stand_pat = q_eval;
         Movelist captures;
-        Movegen::legalmoves<CAPTURE>(board, captures);
+        generate_moves<CAPTURE>(board, captures);
+        order_captures(board, captures);
         for (auto& capture : captures) {
+            if (prune_capture(board, capture.move, stand_pat, alpha)) {
+                continue;
+            }
             board.makeMove(capture.move);
             Eval_Type inner_eval = -q_search(-beta, -alpha);
             board.unmakeMove(capture.move);
@@ -106,7 +147,7 @@ public:
                     alpha = q_eval;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
                 return q_eval;
             }
         }
@@ -128,9 +169,14 @@ public:
             return q_eval;
         }
 
+        Eval_Type stand_pat = q_eval;
         Movelist captures;
-        Movegen::legalmoves<CAPTURE>(board, captures);
+        generate_moves<CAPTURE>(board, captures);
+        order_captures(board, captures);
         for (auto& capture : captures) {
+            if (prune_capture(board, capture.move, stand_pat, beta - 1)) {
+                continue;
+            }
             board.makeMove(capture.move);
             Eval_Type inner_eval = -nw_q_search(-beta + 1);
             board.unmakeMove(capture.move);
@@ -140,7 +186,7 @@ public:
                     break;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
                 return q_eval;
             }
         }
@@ -156,33 +202,58 @@ public:
             return alpha; // TT entry value is put here
         }
 
-        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
-        Movelist moves;
-        generate_shuffled_moves<ALL>(moves); // We could stop shuffling at low enough depth; won't gain much speedup,
-                                             // but if we had proper move ordering it might produce faster cutoffs
-        int tt_move_index = moves.find(tt_move);
-        if (tt_move_index > 0) {
-            std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
+        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0}; // If we don't find a move, keep the old TT move
+        Selectivity selectivity(board, beta, depth);
+        if (selectivity.null_move()) {
+            int null_depth = depth - 1 - null_move_reduction;
+            board.makeNullMove();
+            Eval_Type null_eval = null_depth > 0 ? -null_window_search(-beta + 1, null_depth) : -nw_q_search(-beta + 1);
+            board.unmakeNullMove();
+            if (stop_poll(nodes)) {
+                return eval;
+            }
+            if (null_eval >= beta) {
+                entry.eval = null_eval;
+                entry.type = LOWER_BOUND;
+                tt.emplace(board.hashKey, entry, depth);
+                return null_eval;
+            }
         }
-        for (auto& move : moves) {
-            board.makeMove(move.move);
+
+        Move_Picker moves(board, tt_move, depth >= SHUFFLE_DEPTH ? &rng : nullptr, &order, depth);
+        int move_index = 0;
+        for (Move move = moves.next(); move != NO_MOVE; move = moves.next(), move_index++) {
+            bool quiet = !is_capture(board, move);
+            board.makeMove(move);
+            if (selectivity.skip(board, quiet, move_index)) {
+                board.unmakeMove(move);
+                eval = std::max(eval, selectivity.futility_bound(depth));
+                continue;
+            }
+            int reduction = selectivity.reduction(board, quiet, move_index, depth);
             Eval_Type inner_eval;
-            if (depth > 1) {
+            if (reduction > 0) {
+                inner_eval = -null_window_search(-beta + 1, depth - 1 - reduction);
+                if (inner_eval >= beta && !stop_poll(nodes)) { // Verify at full depth
+                    inner_eval = -null_window_search(-beta + 1, depth - 1);
+                }
+            } else if (depth > 1) {
                 inner_eval = -null_window_search(-beta + 1, depth - 1);
             } else {
                 inner_eval = -nw_q_search(-beta + 1);
             }
-            board.unmakeMove(move.move);
+            board.unmakeMove(move);
 
             if (inner_eval > eval) {
                 eval = inner_eval;
-                entry.move = move.move;
+                entry.move = move;
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
                 return eval;
             }
         }
@@ -198,17 +269,12 @@ public:
             return alpha; // TT entry value is put here
         }
 
-        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
-        Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
-        int tt_move_index = moves.find(tt_move);
-        if (tt_move_index > 0) {
-            std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
-        }
+        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0}; // If we don't find a move, keep the old TT move
+        Move_Picker moves(board, tt_move, depth >= SHUFFLE_DEPTH ? &rng : nullptr, &order, depth);
 
         bool search_full_window = true;
-        for (auto& move : moves) {
-            board.makeMove(move.move);
+        for (Move move = moves.next(); move != NO_MOVE; move = moves.next()) {
+            board.makeMove(move);
             Eval_Type inner_eval;
             if (depth == 1) {
                 inner_eval = -q_search(-beta, -alpha);
@@ -216,13 +282,14 @@ public:
                 inner_eval = -pv_search(-beta, -alpha, depth - 1);
                 search_full_window = false;
             }
-            board.unmakeMove(move.move);
+            board.unmakeMove(move);
 
             if (inner_eval > eval) {
                 eval = inner_eval;
-                entry.move = move.move; // If it stays this way, this is the best move
+                entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
                 if (eval > alpha) {
@@ -231,7 +298,7 @@ public:
                 }
             }
 
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
                 return eval;
             }
         }
@@ -247,23 +314,24 @@ public:
             return alpha; // TT entry value is put here
         }
 
-        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
+        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0}; // If we don't find a move, keep the old TT move
         Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
+        generate_shuffled_moves<ALL>(moves, depth);
         // TODO why there no hashmove first here?
-        for (auto& move : moves) {
-            board.makeMove(move.move);
+        for (int move_index = 0; move_index < moves.size; move_index++) {
+            Move move = pick_move(moves, move_index, depth);
+            board.makeMove(move);
             Eval_Type inner_eval;
             if (depth > 1) {
                 inner_eval = -nega_max(-beta, -alpha, depth - 1);
             } else {
                 inner_eval = -q_search(-beta, -alpha);
             }
-            board.unmakeMove(move.move);
+            board.unmakeMove(move);
 
             if (inner_eval > eval) {
                 eval = inner_eval;
-                entry.move = move.move; // If it stays this way, this is the best move
+                entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
                     break;
@@ -274,7 +342,7 @@ public:
                 }
             }
 
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
                 return eval;
             }
         }
@@ -284,8 +352,10 @@ public:
     }
 
     template<class Search_Result, bool PV_Search>
-    void root_max(Eval_Type alpha, Eval_Type beta, int depth, Search_Result& result, std::atomic<uint64_t>& total_node_count) {
+    void root_max(Eval_Type alpha, Eval_Type beta, int depth, Shared_Root& root, Search_Result& result, std::atomic<uint64_t>& total_node_count) {
         nodes = 0;
+        order.new_iteration();
+        stop_poll.reset();
         assert(depth > 0);
         Eval_Type eval = MIN_EVAL;
         Move tt_move = NO_MOVE;
@@ -294,7 +364,7 @@ public:
         }
 
         Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
+        generate_shuffled_moves<ALL>(moves, depth);
         int tt_move_index = moves.find(tt_move);
         if (tt_move_index > 0) {
             std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
@@ -303,8 +373,8 @@ public:
         Move best_move = NO_MOVE;
 
         bool search_full_window = true;
-        for (auto& move_container : moves) {
-            auto move = move_container.move;
+        for (int move_index = 0; move_index < moves.size; move_index++) {
+            Move move = pick_move(moves, move_index, depth);
             board.makeMove(move);
             Eval_Type inner_eval;
             if (depth == 1) {
@@ -323,6 +393,10 @@ public:
             }
             board.unmakeMove(move);
 
+            if (finished.is_set()) { // Before using inner_eval, which an abort makes garbage
+                total_node_count += nodes;
+                return;
+            }
             if (inner_eval > eval) {
                 eval = inner_eval;
                 best_move = move;
@@ -333,15 +407,11 @@ public:
                     alpha = eval;
                 }
             }
-
-            if (finished) {
-                total_node_count += nodes;
-                return;
-            }
+            root.record_best(best_move, eval); // So a halt can still report what we completed
         }
-        tt.emplace(board.hashKey, {eval, best_move, (int8_t) depth, EXACT}, depth);
+        tt.emplace(board.hashKey, {eval, best_move, (int8_t) depth, EXACT, 0}, depth);
 
-        bool i_am_first = !finished.exchange(true); // Setting finished to true tells all threads to finish.
+        bool i_am_first = finished.stop(); // Setting finished to true tells all threads to finish.
         // Surprisingly, this can lead to a slowdown at low depths, in testing up to depth 9 which does take multiple
         // seconds. However, for depth 10 and much more so depth 11 this leads to a big speedup.
 
@@ -352,42 +422,177 @@ public:
         }
         total_node_count += nodes;
     }
+
+    /**
+     * Generates the root moves of a cooperative root search, with the TT move first. Call this before starting the
+     * threads, all of them will search this same move list.
+     */
+    void prepare_root(Shared_Root& root, int depth) {
+        Move tt_move = NO_MOVE;
+        Eval_Type alpha = MIN_EVAL, beta = MAX_EVAL;
+        tt_probe(tt_move, alpha, beta, depth); // Only interested in the move, at the root we always search
+        generate_moves<ALL>(board, root.moves);
+        for (int i = 0; i < root.moves.size; i++) { // Threads claim root moves by index, so they all get shuffled now
+            shuffle_step(root.moves, i, rng);
+        }
+        int tt_move_index = root.moves.find(tt_move);
+        if (tt_move_index > 0) {
+            std::swap(root.moves[0], root.moves[tt_move_index]); // Search the TT move first
+        }
+    }
+
+    /**
+     * Root search where the threads split the root moves between them via the shared root, see Shared_Root.
+     */
+    template<class Search_Result, bool PV_Search>
+    void cooperative_root_max(int depth, Shared_Root& root, Search_Result& result, std::atomic<uint64_t>& total_node_count) {
+        nodes = 0;
+        order.new_iteration();
+        stop_poll.reset();
+        assert(depth > 0);
+        if (root.moves.size == 0) { // Nothing to split, whoever gets here first reports the empty result
+            if (finished.stop()) {
+                result.move = NO_MOVE;
+                result.eval = MIN_EVAL;
+                result.depth = depth;
+            }
+            return;
+        }
+        int move_index = 0;
+        while (move_index < root.moves.size) {
+            Move move = root.moves[move_index].move;
+            Eval_Type alpha = root.alpha; // Pick up the best bound any thread has proven so far
+            board.makeMove(move);
+            Eval_Type inner_eval;
+            if (depth == 1) {
+                inner_eval = -q_search(-MAX_EVAL, -alpha);
+            } else if constexpr (!PV_Search) {
+                inner_eval = -nega_max(-MAX_EVAL, -alpha, depth - 1);
+            } else if (move_index == 0 || (inner_eval = -null_window_search(-alpha, depth - 1)) > alpha) {
+                inner_eval = -pv_search(-MAX_EVAL, -alpha, depth - 1);
+            }
+            board.unmakeMove(move);
+
+            if (finished.is_set()) { // Our result may be from an aborted search, and someone else completed the iteration
+                break;
+            }
+            if (root.complete_move(move_index, move, inner_eval)) { // We completed the last root move
+                tt.emplace(board.hashKey, {root.best_eval, root.best_move, (int8_t) depth, EXACT, 0}, depth);
+                finished.stop();
+                result.move = root.best_move;
+                result.eval = root.best_eval;
+                result.depth = depth;
+                break;
+            }
+            move_index = root.claim_move(move_index);
+        }
+        total_node_count += nodes;
+    }
 };
 
 template<bool Q_SEARCH, TT_Strategy strategy>
 class Lazy_SMP {
 
-    std::atomic<bool> finished = false;
+    Stop_Signal finished;
     size_t num_threads;
+    uint64_t seed = 0;
+    Live_Stats stats;
+    std::chrono::milliseconds report_interval{0};
+    std::function<void(const Search_Progress&)> report = print_progress;
+    Search_Clock clock;
     std::vector<Search_Thread<Q_SEARCH, strategy>> searchers;
 
 public:
     Lazy_SMP(size_t num_threads, Board& board, Locking_TT<strategy>& table) : num_threads(num_threads),
-                    searchers(num_threads, Search_Thread<Q_SEARCH, strategy>(board, table, finished)) {
+                    stats(num_threads), searchers(num_threads, Search_Thread<Q_SEARCH, strategy>(board, table, finished)) {
+        for (size_t i = 0; i < num_threads; i++) {
+            searchers[i].set_live_nodes(stats.thread_nodes(i));
+        }
+    }
+
+    /**
+     * Reports the progress of every search to report each interval, on a separate thread. An interval of 0 turns it off.
+     */
+    void set_reporting(std::chrono::milliseconds interval,
+                       std::function<void(const Search_Progress&)> callback = print_progress) {
+        report_interval = interval;
+        report = std::move(callback);
+    }
+
+    /**
+     * Ends the running search, e.g. an infinite one; thread safe. The search returns the result of the last iteration
+     * it completed, or the best root move completed in the one it got halted in.
+     */
+    void halt() {
+        clock.halt();
+    }
+
+    /**
+     * Seeds the pseudo random eval and, with DETERMINISTIC_SEARCH, the move orders of the threads.
+     */
+    void set_seed(uint64_t search_seed) {
+        seed = search_seed;
     }
 
     /**
      *
      * @tparam Search_Result
      * @tparam PV_Search
-     * @param up_to_depth Search for each depth from 1 to up_to_depth through iterative deepening.
+     * @param limits Search for each depth from 1 on through iterative deepening, until reaching one of the limits.
      * @param iteration Optional parameter, if passed will be printed in the output. Useful for automated benchmarks.
+     * @tparam Cooperative_Root If true, the threads split the root moves between them and share their root bound
+     * instead of each searching all root moves independently, see Shared_Root.
      * @return
      */
-    template<class Search_Result, bool PV_Search>
-    Search_Result parallel_search(int up_to_depth, int iteration = 0) {
+    template<class Search_Result, bool PV_Search, bool Cooperative_Root = false>
+    Search_Result parallel_search(const Search_Limits& limits, int iteration = 0) {
         Search_Result result;
-        for (int depth = 1; depth <= up_to_depth; depth++) {
+        clock.start_search(limits, finished);
+        stats.start_search();
+        std::optional<Progress_Reporter> reporter;
+        if (report_interval.count() > 0) {
+            reporter.emplace(stats, report_interval, report);
+        }
+        std::optional<Limit_Watcher> watcher;
+        if (clock.needs_watching()) {
+            watcher.emplace(clock, stats);
+        }
+        double last_duration = 0, previous_duration = 0;
+        for (int depth = 1; depth <= limits.depth; depth++) {
+            if (depth > 1 && clock.soft_limit_reached(last_duration, iteration_growth(last_duration, previous_duration))) {
+                break; // Better to stop now than to start an iteration we would have to abandon
+            }
             std::vector<std::thread> search_threads;
             Eval_Type alpha = MIN_EVAL;
             Eval_Type beta = MAX_EVAL;
-            finished = false;
+            finished.reset();
+            if (clock.is_halted()) { // Checked after the reset, which would undo the stop signal of the halt
+                break;
+            }
+            Load_Balance load_balance(num_threads);
+            std::atomic<uint64_t> allocations = 0;
+            std::atomic<uint64_t> movegen_time = 0;
             std::atomic<uint64_t > node_count = 0;
+            Shared_Root shared_root;
+            for (size_t i = 0; i < num_threads; i++) {
+                searchers[i].set_rng(move_order_rng(seed, i, depth));
+            }
+            stats.start_iteration(depth);
             auto start = std::chrono::high_resolution_clock::now();
+            if constexpr (Cooperative_Root) {
+                searchers[0].prepare_root(shared_root, depth);
+            }
             for (size_t i = 0; i < num_threads; i++) {
-                auto func = std::bind(&Search_Thread<Q_SEARCH, strategy>::template root_max<Search_Result, PV_Search>,
-                                      &searchers[i], alpha, beta, depth, std::ref(result), std::ref(node_count));
-                search_threads.emplace_back(func);
+                if constexpr (Cooperative_Root) {
+                    auto func = std::bind(&Search_Thread<Q_SEARCH, strategy>::template cooperative_root_max<Search_Result, PV_Search>,
+                                          &searchers[i], depth, std::ref(shared_root), std::ref(result), std::ref(node_count));
+                    search_threads.emplace_back(load_balance.timed(seeded(timing_movegen(counting_allocations(func, allocations), movegen_time), seed, i), i));
+                } else {
+                    auto func = std::bind(&Search_Thread<Q_SEARCH, strategy>::template root_max<Search_Result, PV_Search>,
+                                          &searchers[i], alpha, beta, depth, std::ref(shared_root), std::ref(result),
+                                          std::ref(node_count));
+                    search_threads.emplace_back(load_balance.timed(seeded(timing_movegen(counting_allocations(func, allocations), movegen_time), seed, i), i));
+                }
             }
             for (auto &thread: search_threads) {
                 thread.join();
@@ -395,10 +600,42 @@ public:
             auto end = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double> duration = end - start;
 
+            if (clock.is_halted() && result.depth != depth) { // Nobody completed the iteration, so keep the last result
+                bool first_move_done = !Cooperative_Root || shared_root.done[0]; // The old best move got its new score
+                if (first_move_done && shared_root.best_move != NO_MOVE) { // Unless root moves of this one got completed
+                    result.move = shared_root.best_move;
+                    result.eval = shared_root.best_eval;
+                }
+                break;
+            }
+            previous_duration = last_duration;
+            last_duration = duration.count();
             result.duration = duration.count();
             result.nodes = node_count;
+            stats.finish_iteration(node_count, result.move, result.eval);
+            for (size_t i = 0; i < num_threads; i++) {
+                load_balance.set_nodes(i, searchers[i].get_nodes());
+            }
+            result.imbalance = load_balance.imbalance();
+            result.heap_allocations = allocations;
+            result.movegen_time = (double) movegen_time / 1e9;
+            result.idle_time = load_balance.idle_time(end);
+            result.stop_latency = load_balance.stop_latency(finished.get_stop_time());
             result.print_table(iteration, num_threads);
         }
+        watcher.reset(); // So that it can't halt the search after we finished it
+        if (clock.is_halted()) {
+            result.halt_latency = clock.halt_latency();
+        }
+        clock.finish_search();
         return result;
     }
+
+    /**
+     * @param up_to_depth Search for each depth from 1 to up_to_depth through iterative deepening.
+     */
+    template<class Search_Result, bool PV_Search, bool Cooperative_Root = false>
+    Search_Result parallel_search(int up_to_depth, int iteration = 0) {
+        return parallel_search<Search_Result, PV_Search, Cooperative_Root>(Search_Limits::to_depth(up_to_depth), iteration);
+    }
 };
@@ -2,53 +2,22 @@
 
 #include <thread>
 #include <functional>
+#include <optional>
 #include "locking_tt.h"
+#include "shared_root.h"
+#include "cutoff_table.h"
+#include "work_stealing.h"
+#include "load_balance.h"
+#include "alloc_counter.h"
+#include "move_picker.h"
+#include "see.h"
+#include "selective.h"
+#include "stop_signal.h"
+#include "live_stats.h"
+#include "search_limits.h"
+#include "defer_policy.h"
+#include "currently_searched.h"
 
-constexpr std::size_t searched_size = 32768;
-constexpr std::size_t position_cache_size = 3;
-
-struct alignas(64) Position_Cache {
-    uint64_t searched_position[position_cache_size]{};
-    Spin_Lock lock;
-};
-
-Position_Cache currently_searched[searched_size];
-
-bool defer_position(uint64_t hash, int depth) {
-    if (depth < DEFER_DEPTH) {
-        return false;
-    }
-    std::size_t position = (hash + depth) & (searched_size - 1);
-    Position_Cache& cache = currently_searched[position];
-    std::lock_guard<Spin_Lock> guard(cache.lock);
-    for (uint64_t stored_hash : cache.searched_position) {
-        if (stored_hash == hash) {
-            return true;
-        }
-    } // If we didn't find anything, we will search this position now
-    for (uint32_t i = 0; i < position_cache_size; i++) {
-        if (cache.searched_position[i] == 0) {
-            cache.searched_position[i] = hash;
-            break;
-        } // If we don't find one, we might have two threads searching this position but that's ok if it happens rarely
-    }
-    return false;
-}
-
-void finished_search(uint64_t hash, int depth) {
-    if (depth < DEFER_DEPTH) {
-        return;
-    }
-    std::size_t position = (hash + depth) & (searched_size - 1);
-    Position_Cache& cache = currently_searched[position];
-    std::lock_guard<Spin_Lock> guard(cache.lock);
-    for (uint64_t & stored_hash : cache.searched_position) {
-        if (stored_hash == hash) {
-            stored_hash = 0;
-            return;
-        }
-    }
-}
 
 template<bool Q_SEARCH, TT_Strategy strategy>
 class alignas (128) Simplified_ABDADA_Thread { // Let's go big with the alignas just in case
@@ -57,7 +26,45 @@ private:
     Board board;
     uint64_t nodes = 0;
     Locking_TT<strategy>& tt;
-    std::atomic<bool>& finished;
+    Stop_Signal& finished;
+    Stop_Poll stop_poll; // Interior nodes check finished through this, only the root reads it directly
+    Cutoff_Table& cutoffs;
+    std::size_t thread_id;
+    uint64_t nodes_saved = 0;
+    Job_Queues& jobs;
+    Deferred_Job stolen_job;
+    bool in_stolen_job = false;
+    uint64_t jobs_stolen = 0;
+    Defer_Policy defer_policy;
+    uint8_t probed_subtree_size = 0; // Subtree size of the last child we found another thread searching
+    Currently_Searched& currently_searched;
+    uint64_t failed_swaps = 0;
+    uint64_t overflows = 0;
+    Counter_RNG rng; // Random move order of this thread, see move_order_rng
+    Move_Order order; // Killers and history of this thread, see MOVE_ORDERING
+
+    /**
+     * @param shared Whether the caller shares this node at all, see Defer_Policy. Set to false if the position could not
+     * be registered, and has to be passed on to the finished_search call like that.
+     * @return true if another thread is already searching this position, so the caller should defer it.
+     */
+    bool defer_position(uint64_t hash, int depth, bool& shared) {
+        if (!shared) {
+            return false;
+        }
+        Currently_Searched::Claim claim = currently_searched.claim(hash, depth, failed_swaps);
+        if (claim == Currently_Searched::OVERFLOWED) { // We search it anyway, other threads just won't know
+            overflows++;
+            shared = false; // Nothing to release, and a release could free the slot of another thread with this key
+        }
+        return claim == Currently_Searched::TAKEN;
+    }
+
+    void finished_search(uint64_t hash, int depth, bool shared) {
+        if (shared) {
+            currently_searched.release(hash, depth);
+        }
+    }
 
     /**
      *
@@ -97,26 +104,150 @@ private:
         return false;
     }
 
+    /**
+     * Besides the global finished flag, we also stop if another thread refuted a shared node we are inside of.
+     */
+    [[nodiscard]] bool aborted() {
+        return stop_poll(nodes) || (CUTOFF_PROPAGATION && cutoffs.abort_requested(thread_id));
+    }
+
+    /**
+     * Called when we stop searching a node early. If another thread refuted this node, we return its cutoff value
+     * instead of our partial result, otherwise the partial result gets discarded further up anyway.
+     */
+    Eval_Type stop_node(const Shared_Node_Entry& shared_node, Eval_Type eval, uint64_t nodes_at_entry) {
+        if (shared_node.refuted()) {
+            nodes_saved += shared_node.nodes_saved(nodes - nodes_at_entry);
+            return shared_node.cutoff_eval();
+        }
+        return eval;
+    }
+
+    /**
+     * Publishes the move we just made and deferred, so that a thread without work of its own can search it.
+     */
+    void publish_job(Eval_Type beta, int depth, uint8_t subtree_size) {
+        if (WORK_STEALING && worth_sharing(subtree_size)) {
+            jobs.publish(thread_id, board, beta, depth);
+        }
+    }
+
+    /**
+     * Call this when all moves left at the current node are deferred, i.e. being searched by other threads. Instead of
+     * joining them right away, we first search a move some other thread deferred; its result goes into the TT, and by
+     * the time we get back to our own deferred moves their searches may be done. Stolen jobs don't steal again, which
+     * keeps the board we set aside here the only one.
+     */
+    void steal_job() {
+        if (!WORK_STEALING || in_stolen_job || !jobs.steal(thread_id, stolen_job)) {
+            return;
+        }
+        in_stolen_job = true;
+        jobs_stolen++;
+        std::swap(board, stolen_job.board);
+        null_window_search(stolen_job.beta, stolen_job.depth);
+        std::swap(board, stolen_job.board);
+        in_stolen_job = false;
+    }
+
+    /**
+     * defer_position for the child we just moved to, plus the bookkeeping of the defer policy. If another thread is
+     * searching the child, its subtree size from the TT ends up in probed_subtree_size.
+     * @param shared Gets set to false if we search the child right away although another thread is on it, since then the
+     * entry in the currently searched table is not ours to release.
+     */
+    bool defer_child(int depth, bool& shared) {
+        bool deferred = defer_position(board.hashKey, depth, shared);
+        if (shared) {
+            defer_policy.record_probe(depth, deferred);
+        }
+        if (deferred) {
+            Locked_TT_Info tt_entry{};
+            probed_subtree_size = tt.get_if_exists(board.hashKey, depth, tt_entry) ? tt_entry.subtree_size : 0;
+            if (!worth_deferring(probed_subtree_size)) {
+                shared = false;
+                return false;
+            }
+        }
+        return deferred;
+    }
+
+    /**
+     * Generates the moves in a random order. With LAZY_SHUFFLE only the first move is chosen here, the others when the
+     * search gets to them through pick_move, so a node that cuts off early skips most of the shuffle. Nodes below
+     * SHUFFLE_DEPTH keep the generation order.
+     */
     template<Movetype TYPE>
-    void generate_shuffled_moves(Movelist& moves) {
-        Movegen::legalmoves<TYPE>(board, moves);
-        thread_local static std::mt19937 mt(seed);
+    void generate_shuffled_moves(Movelist& moves, int depth) {
+        generate_moves<TYPE>(board, moves);
+        if (depth < SHUFFLE_DEPTH) {
+            return;
+        }
+        int shuffled = LAZY_SHUFFLE ? std::min(1, (int) moves.size) : moves.size;
+        for (int i = 0; i < shuffled; i++) {
+            shuffle_step(moves, i, rng);
+        }
+    }
 
-        for (int i = 0; i < moves.size; i++) {
-            // Get a random index of the array past the current index.
-            // ... The argument is an exclusive bound.
-            //     It will not go past the array's end.
-            int randomValue = i + (mt() % (moves.size - i)); // One could get rid of this mod but it doesn't appear to be a slowdown currently
-            // Swap the random element with the present element.
-            auto randomElement = moves[randomValue];
-            moves[randomValue] = moves[i];
-            moves[i] = randomElement;
+    /**
+     * @return The move at index, which with LAZY_SHUFFLE gets chosen now. Call this with increasing indices, and only
+     * once per index; the moves before index are already searched and stay where they are.
+     */
+    Move pick_move(Movelist& moves, int index, int depth) {
+        if (LAZY_SHUFFLE && index > 0 && depth >= SHUFFLE_DEPTH) { // Move 0 is chosen at generation, or the TT move
+            shuffle_step(moves, index, rng);
         }
+        return moves[index].move;
     }
 
 public:
-    explicit Simplified_ABDADA_Thread(Board& board, Locking_TT<strategy>& table, std::atomic<bool>& finished)
-            : board(board), tt(table), finished(finished) {
+    explicit Simplified_ABDADA_Thread(Board& board, Locking_TT<strategy>& table, Stop_Signal& finished,
+                                      Cutoff_Table& cutoffs, Job_Queues& jobs, Currently_Searched& currently_searched,
+                                      std::size_t thread_id)
+            : board(board), tt(table), finished(finished), stop_poll(finished), cutoffs(cutoffs), thread_id(thread_id),
+              jobs(jobs),
+              currently_searched(currently_searched) {
+        defer_policy.reset(DEFER_DEPTH, false);
+    }
+
+    /**
+     * @param depth The depth from which on nodes are shared, or the starting depth if adaptive.
+     * @param adaptive Whether the depth adapts to the contention this thread observes, see Defer_Policy.
+     */
+    void set_defer_policy(int32_t depth, bool adaptive) {
+        defer_policy.reset(depth, adaptive);
+    }
+
+    [[nodiscard]] int32_t get_defer_depth() const {
+        return defer_policy.depth();
+    }
+
+    [[nodiscard]] uint64_t get_nodes_saved() const {
+        return nodes_saved;
+    }
+
+    void set_live_nodes(std::atomic<uint64_t>& counter) {
+        stop_poll.publish_to(counter);
+    }
+
+    void set_rng(const Counter_RNG& stream) {
+        rng = stream;
+    }
+
+    [[nodiscard]] uint64_t get_nodes() const {
+        return nodes;
+    }
+
+    [[nodiscard]] uint64_t get_jobs_stolen() const {
+        return jobs_stolen;
+    }
+
+    [[nodiscard]] uint64_t get_failed_swaps() const {
+        return failed_swaps;
+    }
+
+    [[nodiscard]] uint64_t get_overflows() const {
+        return overflows;
     }
 
     Eval_Type q_search(Eval_Type alpha, Eval_Type beta) {
@@ -136,9 +267,14 @@ public:
             alpha = q_eval;
         }
 
+        Eval_Type stand_pat = q_eval;
         Movelist captures;
-        Movegen::legalmoves<CAPTURE>(board, captures);
+        generate_moves<CAPTURE>(board, captures);
+        order_captures(board, captures);
         for (auto& capture : captures) {
+            if (prune_capture(board, capture.move, stand_pat, alpha)) {
+                continue;
+            }
             board.makeMove(capture.move);
             Eval_Type inner_eval = -q_search(-beta, -alpha);
             board.unmakeMove(capture.move);
@@ -151,7 +287,7 @@ public:
                     alpha = q_eval;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (aborted()) { // If someone else already completed the search there is no reason for us to continue
                 return q_eval;
             }
         }
@@ -173,9 +309,14 @@ public:
             return q_eval;
         }
 
+        Eval_Type stand_pat = q_eval;
         Movelist captures;
-        Movegen::legalmoves<CAPTURE>(board, captures);
+        generate_moves<CAPTURE>(board, captures);
+        order_captures(board, captures);
         for (auto& capture : captures) {
+            if (prune_capture(board, capture.move, stand_pat, beta - 1)) {
+                continue;
+            }
             board.makeMove(capture.move);
             Eval_Type inner_eval = -nw_q_search(-beta + 1);
             board.unmakeMove(capture.move);
@@ -185,7 +326,7 @@ public:
                     break;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (aborted()) { // If someone else already completed the search there is no reason for us to continue
                 return q_eval;
             }
         }
@@ -201,69 +342,114 @@ public:
             return alpha; // TT entry value is put here
         }
 
-        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
-        Movelist moves;
-        generate_shuffled_moves<ALL>(moves); // We could stop shuffling at low enough depth; won't gain much speedup,
-        // but if we had proper move ordering it might produce faster cutoffs
-        int tt_move_index = moves.find(tt_move);
-        if (tt_move_index > 0) {
-            std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
+        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0}; // If we don't find a move, keep the old TT move
+        Shared_Node_Entry shared_node(cutoffs, defer_policy.shares(depth), board.hashKey, depth, beta, thread_id);
+        uint64_t nodes_at_entry = nodes;
+        Selectivity selectivity(board, beta, depth);
+        if (selectivity.null_move()) {
+            int null_depth = depth - 1 - null_move_reduction;
+            board.makeNullMove();
+            Eval_Type null_eval = null_depth > 0 ? -null_window_search(-beta + 1, null_depth) : -nw_q_search(-beta + 1);
+            board.unmakeNullMove();
+            if (aborted() || shared_node.refuted()) {
+                return stop_node(shared_node, eval, nodes_at_entry);
+            }
+            if (null_eval >= beta) {
+                entry.eval = null_eval;
+                entry.type = LOWER_BOUND;
+                shared_node.cutoff(null_eval, nodes - nodes_at_entry);
+                tt.emplace(board.hashKey, entry, depth);
+                return null_eval;
+            }
         }
 
-        std::vector<Move> deferred_moves{};
-        deferred_moves.reserve(moves.size);
+        Move_Picker moves(board, tt_move, depth >= SHUFFLE_DEPTH ? &rng : nullptr, &order, depth);
 
-        for (int i = 0; i < moves.size; i++) {
-            auto move = moves[i].move;
+        Deferred_List deferred_moves;
+
+        int i = 0;
+        for (Move move = moves.next(); move != NO_MOVE; move = moves.next(), i++) {
+            bool quiet = !is_capture(board, move);
+            bool shared_child = i != 0 && defer_policy.shares(depth - 1); // Move 0 never gets claimed, so never released
             board.makeMove(move);
-            if (i != 0 && defer_position(board.hashKey, depth - 1)) {
-                deferred_moves.emplace_back(move);
+            if (selectivity.skip(board, quiet, i)) {
+                board.unmakeMove(move);
+                eval = std::max(eval, selectivity.futility_bound(depth));
+                continue;
+            }
+            int reduction = selectivity.reduction(board, quiet, i, depth);
+            if (reduction > 0) { // Reduced moves are cheap, so we search them right away instead of deferring them
+                shared_child = false;
+            } else if (i != 0 && defer_child(depth - 1, shared_child)) {
+                deferred_moves.push_back({move, probed_subtree_size});
+                publish_job(-beta + 1, depth - 1, probed_subtree_size);
                 board.unmakeMove(move);
                 continue;
             }
 
             Eval_Type inner_eval;
-            if (depth > 1) {
+            if (reduction > 0) {
+                inner_eval = -null_window_search(-beta + 1, depth - 1 - reduction);
+                if (inner_eval >= beta && !aborted()) { // Verify at full depth
+                    inner_eval = -null_window_search(-beta + 1, depth - 1);
+                }
+            } else if (depth > 1) {
                 inner_eval = -null_window_search(-beta + 1, depth - 1);
             } else {
                 inner_eval = -nw_q_search(-beta + 1);
             }
-            finished_search(board.hashKey, depth - 1); // Call this before we unmove and change the hashkey.
+            finished_search(board.hashKey, depth - 1, shared_child); // Call this before we unmove and change the hashkey.
             board.unmakeMove(move);
 
+            if (aborted() || shared_node.refuted()) { // Checked before using inner_eval, which an abort makes garbage
+                return stop_node(shared_node, eval, nodes_at_entry);
+            }
             if (inner_eval > eval) {
                 eval = inner_eval;
                 entry.move = move;
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
+                    shared_node.cutoff(eval, nodes - nodes_at_entry);
                     break;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
-                return eval;
-            }
         }
 
-        for (auto move : deferred_moves) {
+        if (!deferred_moves.empty() && entry.type != LOWER_BOUND) {
+            steal_job();
+        }
+        order_deferred(deferred_moves);
+        for (auto& deferred : deferred_moves) {
+            Move move = deferred.move;
+            if (entry.type == LOWER_BOUND) {
+                break;
+            }
             board.makeMove(move);
             Eval_Type inner_eval = -null_window_search(-beta + 1, depth - 1);
             board.unmakeMove(move);
 
+            if (aborted() || shared_node.refuted()) {
+                return stop_node(shared_node, eval, nodes_at_entry);
+            }
             if (inner_eval > eval) {
                 eval = inner_eval;
                 entry.move = move;
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
+                    shared_node.cutoff(eval, nodes - nodes_at_entry);
                     break;
                 }
             }
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
-                return eval;
-            }
         }
 
         entry.eval = eval;
+        if constexpr (SUBTREE_SIZES) {
+            entry.subtree_size = subtree_size_log(nodes - nodes_at_entry);
+        }
         tt.emplace(board.hashKey, entry, depth);
+        defer_policy.record_subtree(depth, nodes - nodes_at_entry);
         return eval;
     }
 
@@ -274,23 +460,20 @@ public:
             return alpha; // TT entry value is put here
         }
 
-        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
-        Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
-        int tt_move_index = moves.find(tt_move);
-        if (tt_move_index > 0) {
-            std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
-        }
+        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0}; // If we don't find a move, keep the old TT move
+        uint64_t nodes_at_entry = nodes;
+        Move_Picker moves(board, tt_move, depth >= SHUFFLE_DEPTH ? &rng : nullptr, &order, depth);
 
-        std::vector<Move> deferred_moves{};
-        deferred_moves.reserve(moves.size);
+        Deferred_List deferred_moves;
 
         bool search_full_window = true;
-        for (int i = 0; i < moves.size; i++) {
-            auto move = moves[i].move;
+        int i = 0;
+        for (Move move = moves.next(); move != NO_MOVE; move = moves.next(), i++) {
+            bool shared_child = i != 0 && defer_policy.shares(depth - 1); // Move 0 never gets claimed, so never released
             board.makeMove(move);
-            if (i != 0 && defer_position(board.hashKey, depth - 1)) {
-                deferred_moves.emplace_back(move);
+            if (i != 0 && defer_child(depth - 1, shared_child)) {
+                deferred_moves.push_back({move, probed_subtree_size});
+                publish_job(-alpha, depth - 1, probed_subtree_size);
                 board.unmakeMove(move);
                 continue;
             }
@@ -299,12 +482,13 @@ public:
             if (depth == 1) {
                 inner_eval = -q_search(-beta, -alpha);
             } else if (search_full_window || (inner_eval = -null_window_search(-alpha, depth - 1)) > alpha) {
-                finished_search(board.hashKey, depth - 1); // Full window search means we want help from other threads; this will get called again below but that's fine
+                finished_search(board.hashKey, depth - 1, shared_child); // Full window search means we want help from other threads
+                shared_child = false; // Released, a second release could free the claim of another thread
 
                 inner_eval = -pv_search(-beta, -alpha, depth - 1);
                 search_full_window = false;
             }
-            finished_search(board.hashKey, depth - 1); // Call this before we unmove and change the hashkey.
+            finished_search(board.hashKey, depth - 1, shared_child); // Call this before we unmove and change the hashkey.
             board.unmakeMove(move);
 
             if (inner_eval > eval) {
@@ -312,6 +496,7 @@ public:
                 entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
                 if (eval > alpha) {
@@ -320,12 +505,17 @@ public:
                 }
             }
 
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
                 return eval;
             }
         }
 
-        for (auto move : deferred_moves) {
+        if (!deferred_moves.empty() && entry.type != LOWER_BOUND) {
+            steal_job();
+        }
+        order_deferred(deferred_moves);
+        for (auto& deferred : deferred_moves) {
+            Move move = deferred.move;
             board.makeMove(move);
             Eval_Type inner_eval;
             if ((inner_eval = -null_window_search(-alpha, depth - 1)) > alpha) {
@@ -338,6 +528,7 @@ public:
                 entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
                 if (eval > alpha) {
@@ -346,12 +537,15 @@ public:
                 }
             }
 
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
                 return eval;
             }
         }
 
         entry.eval = eval;
+        if constexpr (SUBTREE_SIZES) {
+            entry.subtree_size = subtree_size_log(nodes - nodes_at_entry);
+        }
         tt.emplace(board.hashKey, entry, depth);
         return eval;
     }
@@ -363,22 +557,18 @@ public:
             return alpha; // TT entry value is put here
         }
 
-        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND}; // If we don't find a move, keep the old TT move
-        Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
-        int tt_move_index = moves.find(tt_move);
-        if (tt_move_index > 0) {
-            std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
-        }
+        Locked_TT_Info entry{eval, tt_move, (int8_t) depth, UPPER_BOUND, 0}; // If we don't find a move, keep the old TT move
+        uint64_t nodes_at_entry = nodes;
+        Move_Picker moves(board, tt_move, depth >= SHUFFLE_DEPTH ? &rng : nullptr, &order, depth);
 
-        std::vector<Move> deferred_moves{};
-        deferred_moves.reserve(moves.size);
+        Deferred_List deferred_moves;
 
-        for (int i = 0; i < moves.size; i++) {
-            auto move = moves[i].move;
+        int i = 0;
+        for (Move move = moves.next(); move != NO_MOVE; move = moves.next(), i++) {
+            bool shared_child = i != 0 && defer_policy.shares(depth - 1); // Move 0 never gets claimed, so never released
             board.makeMove(move);
-            if (i != 0 && defer_position(board.hashKey, depth - 1)) {
-                deferred_moves.emplace_back(move);
+            if (i != 0 && defer_child(depth - 1, shared_child)) {
+                deferred_moves.push_back({move, probed_subtree_size});
                 board.unmakeMove(move);
                 continue;
             }
@@ -389,7 +579,7 @@ public:
             } else {
                 inner_eval = -q_search(-beta, -alpha);
             }
-            finished_search(board.hashKey, depth - 1); // Call this before we unmove and change the hashkey.
+            finished_search(board.hashKey, depth - 1, shared_child); // Call this before we unmove and change the hashkey.
             board.unmakeMove(move);
 
             if (inner_eval > eval) {
@@ -397,6 +587,7 @@ public:
                 entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
                 if (eval > alpha) {
@@ -405,12 +596,14 @@ public:
                 }
             }
 
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
                 return eval;
             }
         }
 
-        for (auto move : deferred_moves) {
+        order_deferred(deferred_moves);
+        for (auto& deferred : deferred_moves) {
+            Move move = deferred.move;
             board.makeMove(move);
             Eval_Type inner_eval = -nega_max(-beta, -alpha, depth - 1);
             board.unmakeMove(move);
@@ -420,6 +613,7 @@ public:
                 entry.move = move; // If it stays this way, this is the best move
                 if (eval >= beta) {
                     entry.type = LOWER_BOUND;
+                    order.record_cutoff(board, move, depth);
                     break;
                 }
                 if (eval > alpha) {
@@ -428,19 +622,28 @@ public:
                 }
             }
 
-            if (finished) { // If someone else already completed the search there is no reason for us to continue
+            if (stop_poll(nodes)) { // If someone else already completed the search there is no reason for us to continue
                 return eval;
             }
         }
 
         entry.eval = eval;
+        if constexpr (SUBTREE_SIZES) {
+            entry.subtree_size = subtree_size_log(nodes - nodes_at_entry);
+        }
         tt.emplace(board.hashKey, entry, depth);
         return eval;
     }
 
     template<class Search_Result, bool PV_Search>
-    void root_max(Eval_Type alpha, Eval_Type beta, int depth, Search_Result& result, std::atomic<uint64_t>& total_node_count) {
+    void root_max(Eval_Type alpha, Eval_Type beta, int depth, Shared_Root& root, Search_Result& result, std::atomic<uint64_t>& total_node_count) {
         nodes = 0;
+        order.new_iteration();
+        stop_poll.reset();
+        nodes_saved = 0;
+        jobs_stolen = 0;
+        failed_swaps = 0;
+        overflows = 0;
         assert(depth > 0);
         Eval_Type eval = MIN_EVAL;
         Move tt_move = NO_MOVE;
@@ -449,23 +652,26 @@ public:
         }
 
         Movelist moves;
-        generate_shuffled_moves<ALL>(moves);
+        generate_shuffled_moves<ALL>(moves, depth);
         int tt_move_index = moves.find(tt_move);
         if (tt_move_index > 0) {
             std::swap(moves[0], moves[tt_move_index]); // Search the TT move first
         }
 
-        std::vector<Move> deferred_moves{};
-        deferred_moves.reserve(moves.size);
+        Deferred_List deferred_moves;
 
         Move best_move = NO_MOVE;
 
         bool search_full_window = true;
         for (int i = 0; i < moves.size; i++) {
-            auto move = moves[i].move;
+            auto move = pick_move(moves, i, depth);
+            bool shared_child = i != 0 && defer_policy.shares(depth - 1); // Move 0 never gets claimed, so never released
             board.makeMove(move);
-            if (i != 0 && defer_position(board.hashKey, depth - 1)) {
-                deferred_moves.emplace_back(move);
+            if (i != 0 && defer_child(depth - 1, shared_child)) {
+                deferred_moves.push_back({move, probed_subtree_size});
+                if constexpr (PV_Search) {
+                    publish_job(-alpha, depth - 1, probed_subtree_size);
+                }
                 board.unmakeMove(move);
                 continue;
             }
@@ -476,7 +682,8 @@ public:
             } else if constexpr (!PV_Search) {
                 inner_eval = -nega_max(-beta, -alpha, depth - 1);
             } else if (search_full_window || (inner_eval = -null_window_search(-alpha, depth - 1)) > alpha) {
-                finished_search(board.hashKey, depth - 1); // Full window search means we want help from other threads; this will get called again below but that's fine
+                finished_search(board.hashKey, depth - 1, shared_child); // Full window search means we want help from other threads
+                shared_child = false; // Released, a second release could free the claim of another thread
                 inner_eval = -pv_search(-beta, -alpha, depth - 1);
                 search_full_window = false;
             }
@@ -486,9 +693,13 @@ public:
                 tt.print_pv(board, depth - 1);
                 tt.print_size();
             }
-            finished_search(board.hashKey, depth - 1); // Full window search means we want help from other threads; this will get called again below but that's fine
+            finished_search(board.hashKey, depth - 1, shared_child); // Call this before we unmove and change the hashkey.
             board.unmakeMove(move);
 
+            if (finished.is_set()) { // Before using inner_eval, which an abort makes garbage
+                total_node_count += nodes;
+                return;
+            }
             if (inner_eval > eval) {
                 eval = inner_eval;
                 best_move = move;
@@ -499,14 +710,15 @@ public:
                     alpha = eval;
                 }
             }
-
-            if (finished) {
-                total_node_count += nodes;
-                return;
-            }
+            root.record_best(best_move, eval); // So a halt can still report what we completed
         }
 
-        for (auto move : deferred_moves) {
+        if (PV_Search && !deferred_moves.empty() && eval < beta) {
+            steal_job();
+        }
+        order_deferred(deferred_moves);
+        for (auto& deferred : deferred_moves) {
+            Move move = deferred.move;
             board.makeMove(move);
             Eval_Type inner_eval;
             if constexpr (!PV_Search) {
@@ -522,6 +734,10 @@ public:
             }
             board.unmakeMove(move);
 
+            if (finished.is_set()) { // Before using inner_eval, which an abort makes garbage
+                total_node_count += nodes;
+                return;
+            }
             if (inner_eval > eval) {
                 eval = inner_eval;
                 best_move = move;
@@ -532,16 +748,12 @@ public:
                     alpha = eval;
                 }
             }
-
-            if (finished) {
-                total_node_count += nodes;
-                return;
-            }
+            root.record_best(best_move, eval); // So a halt can still report what we completed
         }
 
-        tt.emplace(board.hashKey, {eval, best_move, (int8_t) depth, EXACT}, depth);
+        tt.emplace(board.hashKey, {eval, best_move, (int8_t) depth, EXACT, 0}, depth);
 
-        bool i_am_first = !finished.exchange(true); // Setting finished to true tells all threads to finish.
+        bool i_am_first = finished.stop(); // Setting finished to true tells all threads to finish.
         // Surprisingly, this can lead to a slowdown at low depths, in testing up to depth 9 which does take multiple
         // seconds. However, for depth 10 and much more so depth 11 this leads to a big speedup.
 
@@ -552,42 +764,204 @@ public:
         }
         total_node_count += nodes;
     }
+
+    /**
+     * Generates the root moves of a cooperative root search, with the TT move first. Call this before starting the
+     * threads, all of them will search this same move list.
+     */
+    void prepare_root(Shared_Root& root, int depth) {
+        Move tt_move = NO_MOVE;
+        Eval_Type alpha = MIN_EVAL, beta = MAX_EVAL;
+        tt_probe(tt_move, alpha, beta, depth); // Only interested in the move, at the root we always search
+        generate_moves<ALL>(board, root.moves);
+        for (int i = 0; i < root.moves.size; i++) { // Threads claim root moves by index, so they all get shuffled now
+            shuffle_step(root.moves, i, rng);
+        }
+        int tt_move_index = root.moves.find(tt_move);
+        if (tt_move_index > 0) {
+            std::swap(root.moves[0], root.moves[tt_move_index]); // Search the TT move first
+        }
+    }
+
+    /**
+     * Root search where the threads split the root moves between them via the shared root, see Shared_Root. Claiming
+     * a root move replaces defer_position at the root children; threads helping out with an unfinished root move
+     * share its subtree through the currently searched table as usual.
+     */
+    template<class Search_Result, bool PV_Search>
+    void cooperative_root_max(int depth, Shared_Root& root, Search_Result& result, std::atomic<uint64_t>& total_node_count) {
+        nodes = 0;
+        order.new_iteration();
+        stop_poll.reset();
+        nodes_saved = 0;
+        jobs_stolen = 0;
+        failed_swaps = 0;
+        overflows = 0;
+        assert(depth > 0);
+        if (root.moves.size == 0) { // Nothing to split, whoever gets here first reports the empty result
+            if (finished.stop()) {
+                result.move = NO_MOVE;
+                result.eval = MIN_EVAL;
+                result.depth = depth;
+            }
+            return;
+        }
+        int move_index = 0;
+        while (move_index < root.moves.size) {
+            Move move = root.moves[move_index].move;
+            Eval_Type alpha = root.alpha; // Pick up the best bound any thread has proven so far
+            board.makeMove(move);
+            Eval_Type inner_eval;
+            if (depth == 1) {
+                inner_eval = -q_search(-MAX_EVAL, -alpha);
+            } else if constexpr (!PV_Search) {
+                inner_eval = -nega_max(-MAX_EVAL, -alpha, depth - 1);
+            } else if (move_index == 0 || (inner_eval = -null_window_search(-alpha, depth - 1)) > alpha) {
+                inner_eval = -pv_search(-MAX_EVAL, -alpha, depth - 1);
+            }
+            board.unmakeMove(move);
+
+            if (finished.is_set()) { // Our result may be from an aborted search, and someone else completed the iteration
+                break;
+            }
+            if (root.complete_move(move_index, move, inner_eval)) { // We completed the last root move
+                tt.emplace(board.hashKey, {root.best_eval, root.best_move, (int8_t) depth, EXACT, 0}, depth);
+                finished.stop();
+                result.move = root.best_move;
+                result.eval = root.best_eval;
+                result.depth = depth;
+                break;
+            }
+            move_index = root.claim_move(move_index);
+            if (move_index < root.moves.size && root.next_move > root.moves.size) { // Only helping out is left
+                steal_job();
+            }
+        }
+        total_node_count += nodes;
+    }
 };
 
 template<bool Q_SEARCH, TT_Strategy strategy>
 class Simplified_ABDADA_Search {
 
-    std::atomic<bool> finished = false;
+    Stop_Signal finished;
     size_t num_threads;
+    uint64_t seed = 0;
+    Cutoff_Table cutoffs;
+    Job_Queues jobs;
+    Currently_Searched currently_searched;
+    Live_Stats stats;
+    std::chrono::milliseconds report_interval{0};
+    std::function<void(const Search_Progress&)> report = print_progress;
+    Search_Clock clock;
     std::vector<Simplified_ABDADA_Thread<Q_SEARCH, strategy>> searchers;
 
 public:
-    Simplified_ABDADA_Search(size_t num_threads, Board& board, Locking_TT<strategy>& table) : num_threads(num_threads),
-                                                                  searchers(num_threads, Simplified_ABDADA_Thread<Q_SEARCH, strategy>(board, table, finished)) {
+    Simplified_ABDADA_Search(size_t num_threads, Board& board, Locking_TT<strategy>& table)
+            : num_threads(num_threads), cutoffs(num_threads), jobs(num_threads), currently_searched(num_threads),
+              stats(num_threads) {
+        searchers.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; i++) {
+            searchers.emplace_back(board, table, finished, cutoffs, jobs, currently_searched, i);
+            searchers[i].set_live_nodes(stats.thread_nodes(i));
+        }
+    }
+
+    /**
+     * Sets the defer policy of all threads, see Defer_Policy.
+     */
+    void set_defer_policy(int32_t depth, bool adaptive) {
+        for (auto& searcher : searchers) {
+            searcher.set_defer_policy(depth, adaptive);
+        }
+    }
+
+    /**
+     * Reports the progress of every search to report each interval, on a separate thread. An interval of 0 turns it off.
+     */
+    void set_reporting(std::chrono::milliseconds interval,
+                       std::function<void(const Search_Progress&)> callback = print_progress) {
+        report_interval = interval;
+        report = std::move(callback);
+    }
+
+    /**
+     * Ends the running search, e.g. an infinite one; thread safe. The search returns the result of the last iteration
+     * it completed, or the best root move completed in the one it got halted in.
+     */
+    void halt() {
+        clock.halt();
+    }
+
+    /**
+     * Seeds the pseudo random eval and, with DETERMINISTIC_SEARCH, the move orders of the threads.
+     */
+    void set_seed(uint64_t search_seed) {
+        seed = search_seed;
     }
 
     /**
      *
      * @tparam Search_Result
      * @tparam PV_Search
-     * @param up_to_depth Search for each depth from 1 to up_to_depth through iterative deepening.
+     * @param limits Search for each depth from 1 on through iterative deepening, until reaching one of the limits.
      * @param iteration Optional parameter, if passed will be printed in the output. Useful for automated benchmarks.
+     * @tparam Cooperative_Root If true, the threads split the root moves between them and share their root bound
+     * instead of each searching all root moves independently, see Shared_Root.
      * @return
      */
-    template<class Search_Result, bool PV_Search>
-    Search_Result parallel_search(int up_to_depth, int iteration = 0) {
+    template<class Search_Result, bool PV_Search, bool Cooperative_Root = false>
+    Search_Result parallel_search(const Search_Limits& limits, int iteration = 0) {
         Search_Result result;
-        for (int depth = 1; depth <= up_to_depth; depth++) {
+        clock.start_search(limits, finished);
+        stats.start_search();
+        std::optional<Progress_Reporter> reporter;
+        if (report_interval.count() > 0) {
+            reporter.emplace(stats, report_interval, report);
+        }
+        std::optional<Limit_Watcher> watcher;
+        if (clock.needs_watching()) {
+            watcher.emplace(clock, stats);
+        }
+        double last_duration = 0, previous_duration = 0;
+        for (int depth = 1; depth <= limits.depth; depth++) {
+            if (depth > 1 && clock.soft_limit_reached(last_duration, iteration_growth(last_duration, previous_duration))) {
+                break; // Better to stop now than to start an iteration we would have to abandon
+            }
             std::vector<std::thread> search_threads;
             Eval_Type alpha = MIN_EVAL;
             Eval_Type beta = MAX_EVAL;
-            finished = false;
+            finished.reset();
+            if (clock.is_halted()) { // Checked after the reset, which would undo the stop signal of the halt
+                break;
+            }
+            cutoffs.reset();
+            jobs.clear();
+            currently_searched.clear();
+            Load_Balance load_balance(num_threads);
+            std::atomic<uint64_t> allocations = 0;
+            std::atomic<uint64_t> movegen_time = 0;
             std::atomic<uint64_t > node_count = 0;
+            Shared_Root shared_root;
+            for (size_t i = 0; i < num_threads; i++) {
+                searchers[i].set_rng(move_order_rng(seed, i, depth));
+            }
+            stats.start_iteration(depth);
             auto start = std::chrono::high_resolution_clock::now();
+            if constexpr (Cooperative_Root) {
+                searchers[0].prepare_root(shared_root, depth);
+            }
             for (size_t i = 0; i < num_threads; i++) {
-                auto func = std::bind(&Simplified_ABDADA_Thread<Q_SEARCH, strategy>::template root_max<Search_Result, PV_Search>,
-                                      &searchers[i], alpha, beta, depth, std::ref(result), std::ref(node_count));
-                search_threads.emplace_back(func);
+                if constexpr (Cooperative_Root) {
+                    auto func = std::bind(&Simplified_ABDADA_Thread<Q_SEARCH, strategy>::template cooperative_root_max<Search_Result, PV_Search>,
+                                          &searchers[i], depth, std::ref(shared_root), std::ref(result), std::ref(node_count));
+                    search_threads.emplace_back(load_balance.timed(seeded(timing_movegen(counting_allocations(func, allocations), movegen_time), seed, i), i));
+                } else {
+                    auto func = std::bind(&Simplified_ABDADA_Thread<Q_SEARCH, strategy>::template root_max<Search_Result, PV_Search>,
+                                          &searchers[i], alpha, beta, depth, std::ref(shared_root), std::ref(result),
+                                          std::ref(node_count));
+                    search_threads.emplace_back(load_balance.timed(seeded(timing_movegen(counting_allocations(func, allocations), movegen_time), seed, i), i));
+                }
             }
             for (auto &thread: search_threads) {
                 thread.join();
@@ -595,10 +969,54 @@ public:
             auto end = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double> duration = end - start;
 
+            if (clock.is_halted() && result.depth != depth) { // Nobody completed the iteration, so keep the last result
+                bool first_move_done = !Cooperative_Root || shared_root.done[0]; // The old best move got its new score
+                if (first_move_done && shared_root.best_move != NO_MOVE) { // Unless root moves of this one got completed
+                    result.move = shared_root.best_move;
+                    result.eval = shared_root.best_eval;
+                }
+                break;
+            }
+            previous_duration = last_duration;
+            last_duration = duration.count();
             result.duration = duration.count();
             result.nodes = node_count;
+            stats.finish_iteration(node_count, result.move, result.eval);
+            result.nodes_saved = 0;
+            result.jobs_stolen = 0;
+            result.failed_swaps = 0;
+            result.overflows = 0;
+            for (size_t i = 0; i < num_threads; i++) {
+                result.failed_swaps += searchers[i].get_failed_swaps();
+                result.overflows += searchers[i].get_overflows();
+                result.nodes_saved += searchers[i].get_nodes_saved();
+                result.jobs_stolen += searchers[i].get_jobs_stolen();
+                load_balance.set_nodes(i, searchers[i].get_nodes());
+            }
+            result.imbalance = load_balance.imbalance();
+            result.heap_allocations = allocations;
+            result.movegen_time = (double) movegen_time / 1e9;
+            result.defer_depth = 0;
+            for (auto& searcher : searchers) {
+                result.defer_depth += (double) searcher.get_defer_depth() / (double) num_threads;
+            }
+            result.idle_time = load_balance.idle_time(end);
+            result.stop_latency = load_balance.stop_latency(finished.get_stop_time());
             result.print_table(iteration, num_threads);
         }
+        watcher.reset(); // So that it can't halt the search after we finished it
+        if (clock.is_halted()) {
+            result.halt_latency = clock.halt_latency();
+        }
+        clock.finish_search();
         return result;
     }
+
+    /**
+     * @param up_to_depth Search for each depth from 1 to up_to_depth through iterative deepening.
+     */
+    template<class Search_Result, bool PV_Search, bool Cooperative_Root = false>
+    Search_Result parallel_search(int up_to_depth, int iteration = 0) {
+        return parallel_search<Search_Result, PV_Search, Cooperative_Root>(Search_Limits::to_depth(up_to_depth), iteration);
+    }
 };
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include "compile_time_constants.h"
+
+/**
+ * The flag that ends an iteration: the thread completing the iteration sets it, and every other thread stops. It also
+ * remembers when it got set, so the benchmark can report how long the threads took to notice.
+ */
+class alignas(64) Stop_Signal {
+
+private:
+    using Time_Point = std::chrono::high_resolution_clock::time_point;
+
+    std::atomic<bool> stopped = false;
+    Time_Point stop_time{};
+
+public:
+    /**
+     * Not thread safe, call this between iterations.
+     */
+    void reset() {
+        stopped.store(false, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return true if this call set the signal, i.e. the caller is the one that gets to report the result.
+     */
+    bool stop() {
+        auto now = std::chrono::high_resolution_clock::now();
+        if (stopped.exchange(true, std::memory_order_acq_rel)) {
+            return false;
+        }
+        stop_time = now; // Only read once all threads are joined
+        return true;
+    }
+
+    [[nodiscard]] bool is_set() const {
+        return stopped.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] Time_Point get_stop_time() const {
+        return stop_time;
+    }
+};
+
+/**
+ * A search thread's view of the Stop_Signal. Loading the shared flag at every move keeps its cache line bouncing
+ * between all cores, so this only loads it once per STOP_POLL_NODES nodes and otherwise answers from a copy in the
+ * thread. Once it saw the signal it stays stopped for the rest of the iteration, so the search unwinds without any
+ * further loads. Polling is also when the thread publishes its node count for Live_Stats, if it has a counter there.
+ */
+class Stop_Poll {
+
+private:
+    const Stop_Signal* signal;
+    std::atomic<uint64_t>* live_nodes = nullptr;
+    uint64_t next_poll = 0;
+    bool stopped = false;
+
+public:
+    explicit Stop_Poll(const Stop_Signal& signal) : signal(&signal) {
+    }
+
+    void publish_to(std::atomic<uint64_t>& counter) {
+        live_nodes = &counter;
+    }
+
+    /**
+     * Call this at the start of every iteration, together with resetting the node count.
+     */
+    void reset() {
+        next_poll = 0;
+        stopped = false;
+    }
+
+    /**
+     * @param nodes The node count of the calling thread, which decides when to load the shared flag again.
+     */
+    bool operator()(uint64_t nodes) {
+        if (!stopped && nodes >= next_poll) {
+            next_poll = nodes + STOP_POLL_NODES;
+            stopped = signal->is_set();
+            if (live_nodes != nullptr) {
+                live_nodes->store(nodes, std::memory_order_relaxed);
+            }
+        }
+        return stopped;
+    }
+};
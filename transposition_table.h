@@ -3,6 +3,8 @@
 #include <cstdint>
 #include <iostream>
 #include <vector>
+#include <bit>
+#include <algorithm>
 #include "compile_time_constants.h"
 #include "chess-library/src/chess.hpp"
 
@@ -10,6 +12,40 @@ enum Bound_Type : uint8_t {
     UPPER_BOUND, LOWER_BOUND, EXACT, EVALUATING
 };
 
+/**
+ * The size of a subtree as stored in the TT: the number of bits of its node count, so 0 means unknown and 63 is the most
+ * that fits the 6 bits the ABDADA TT has for it.
+ */
+inline uint8_t subtree_size_log(uint64_t nodes) {
+    return (uint8_t) std::min<uint64_t>(std::bit_width(nodes), 63);
+}
+
+/**
+ * TT aging: entries remember the search that wrote or last read them, so that entries of earlier searches get replaced
+ * before anything of the current one and a TT can be kept from move to move instead of cleared. The age lives in the
+ * low bits of the stored key. Together with the depth of an entry, those bits are implied by the bucket it is in, so
+ * they never told the entries of a bucket apart anyway.
+ */
+constexpr uint64_t tt_age_mask = 63;
+
+inline uint64_t aged_key(uint64_t key, uint8_t age) {
+    return (key & ~tt_age_mask) | age;
+}
+
+inline bool same_position(uint64_t stored_key, uint64_t key) {
+    return ((stored_key ^ key) & ~tt_age_mask) == 0;
+}
+
+/**
+ * @param age The age of the current search.
+ * @return How many searches ago the entry stored with stored_key was last used, 0 for the current one. Ages wrap
+ * around, so entries more than tt_age_mask searches old look younger than they are, but they still rank below
+ * everything the last tt_age_mask searches used. Comparing this is what keeps the current search's entries.
+ */
+inline uint64_t searches_ago(uint64_t stored_key, uint8_t age) {
+    return (age - stored_key) & tt_age_mask;
+}
+
 enum TT_Strategy {
     DEPTH_FIRST, RANDOM_REPLACE, REPLACE_LAST_ENTRY, TWO_TWO_SPLIT
 };
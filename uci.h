@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "search_result.h"
+#include "search_limits.h"
+#include "simple_concurrent_search.h"
+#include "abdada_tt.h"
+#include "abdada_search.h"
+#include "simplified_abdada.h"
+
+constexpr std::size_t uci_default_hash = 256; // MB
+constexpr std::size_t uci_max_threads = 1024;
+constexpr std::chrono::milliseconds uci_report_interval{1000};
+constexpr int uci_moves_to_go = 30; // Moves we plan for when the GUI doesn't say how many are left until the next control
+
+/**
+ * Sends one line to the GUI. Both the input loop and the search threads talk to the GUI, so lines must not interleave.
+ */
+inline void uci_send(const std::string& line) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> guard(mutex);
+    std::cout << line << std::endl;
+}
+
+/**
+ * Reports every completed iteration as a UCI info line instead of a row of the benchmark table. Node counts and nps of
+ * the whole search come with the periodic reports, see UCI_Search_Engine::go. The recorded time to depth is how we
+ * measure what pondering saves.
+ */
+struct UCI_Result : Timed_Result {
+    void print_table(int, int) const {
+        double elapsed = record_depth();
+        std::ostringstream line;
+        line << "info depth " << depth << " score cp " << eval << " time " << (uint64_t) (elapsed * 1000)
+             << " pv " << convertMoveToUci(move);
+        uci_send(line.str());
+    }
+};
+
+/**
+ * What pondering got us so far. A ponder hit saves the time the ponder search took to reach its depth, minus the time
+ * the search after the hit takes to get there again through the TT the ponder search filled.
+ */
+struct Ponder_Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    double saved = 0; // Seconds of time to depth, summed over all hits
+};
+
+/**
+ * One of the parallel searches together with its TT. The TT lives as long as the engine, so it stays filled across go
+ * commands; the input loop only builds a new engine when the hash size or the algorithm changes.
+ */
+class UCI_Engine {
+
+public:
+    virtual ~UCI_Engine() = default;
+
+    /**
+     * Starts searching the board in the background and sends bestmove once done. A ponder search ignores the limits
+     * until ponder_hit, and until then only stop ends it. An infinite or ponder search that ends on its own, at
+     * max_search_depth or without a legal move, holds its bestmove back until stop or ponder_hit, as UCI demands.
+     */
+    virtual void go(Board& board, std::size_t threads, const Search_Limits& limits, bool ponder) = 0;
+
+    /**
+     * The opponent played the move we pondered on, so the board of the ponder search is the real one now.
+     */
+    virtual void ponder_hit() = 0;
+
+    /**
+     * Halts a running search and waits for it to send bestmove. Does nothing if no search is running.
+     */
+    virtual void stop() = 0;
+
+    virtual void new_game() = 0;
+};
+
+template<class Transposition_Table, class Search>
+class UCI_Search_Engine : public UCI_Engine {
+
+private:
+    Transposition_Table tt;
+    std::unique_ptr<Search> search;
+    std::thread worker;
+    Board board;
+    std::size_t threads = 1;
+    Search_Limits limits;
+    bool pondering = false;
+    std::mutex release_mutex; // Guards the three flags below, which decide who sends bestmove
+    std::condition_variable release_signal;
+    bool finished = false; // The search returned, and waits for release if it was infinite
+    bool released = false; // stop or ponder_hit came, an infinite search may send bestmove now
+    bool preempted = false; // Keeps a ponder search we replace on a hit from sending bestmove
+    UCI_Result ponder_result;
+    double preempt_latency = 0; // Seconds from the ponder hit until the ponder search stopped
+    Ponder_Stats ponder_stats; // Only touched by the input loop and, after joining the last one, by the worker
+
+    /**
+     * The reply the search expects to our best move, which the GUI can let us ponder on.
+     */
+    Move ponder_move(const UCI_Result& result) {
+        if (result.move == NO_MOVE || result.depth < 2) {
+            return NO_MOVE;
+        }
+        Board copy(board);
+        copy.makeMove(result.move);
+        Move reply = tt.best_move(copy.hashKey, result.depth - 1);
+        Movelist moves;
+        Movegen::legalmoves<ALL>(copy, moves);
+        return moves.find(reply) >= 0 ? reply : NO_MOVE; // Guards against key collisions
+    }
+
+    void report_ponder_hit(const UCI_Result& result) {
+        int depth = std::min<int>(ponder_result.depth, result.depth);
+        if (depth == 0) {
+            return;
+        }
+        double saved = ponder_result.time_to_depth[depth] - result.time_to_depth[depth];
+        ponder_stats.saved += saved;
+        std::ostringstream line;
+        line << "info string ponderhit depth " << depth
+             << " ponder " << (uint64_t) (ponder_result.time_to_depth[depth] * 1000) << "ms"
+             << " research " << (uint64_t) (result.time_to_depth[depth] * 1000) << "ms"
+             << " saved " << (int64_t) (saved * 1000) << "ms preempt " << preempt_latency * 1000 << "ms"
+             << " total hits " << ponder_stats.hits << " misses " << ponder_stats.misses
+             << " saved " << (int64_t) (ponder_stats.saved * 1000) << "ms";
+        uci_send(line.str());
+    }
+
+    void start(bool ponder) {
+        pondering = ponder;
+        finished = false;
+        released = false;
+        preempted = false;
+        bool after_hit = !ponder && ponder_result.depth > 0;
+        if (!after_hit) { // After a ponder hit, the entries of the ponder search are as good as our own
+            tt.new_search();
+        }
+        search = std::make_unique<Search>(threads, board, tt);
+        search->set_reporting(uci_report_interval, [this](const Search_Progress& progress) {
+            std::ostringstream line;
+            line << "info depth " << progress.depth << " nodes " << progress.nodes << " nps " << (uint64_t) progress.nps
+                 << " time " << (uint64_t) (progress.time * 1000) << " hashfull " << tt.hashfull();
+            uci_send(line.str());
+        });
+        Search_Limits search_limits = limits;
+        search_limits.infinite |= ponder;
+        worker = std::thread([this, search_limits, after_hit]() {
+            UCI_Result result = search->template parallel_search<UCI_Result, true>(search_limits);
+            {
+                std::unique_lock<std::mutex> lock(release_mutex);
+                finished = true;
+                if (preempted) {
+                    ponder_result = result;
+                    return;
+                }
+                if (search_limits.infinite) {
+                    release_signal.wait(lock, [this]() { return released; });
+                }
+            }
+            if (after_hit) {
+                report_ponder_hit(result);
+            }
+            std::string line = "bestmove " + convertMoveToUci(result.move);
+            if (Move reply = ponder_move(result); reply != NO_MOVE) {
+                line += " ponder " + convertMoveToUci(reply);
+            }
+            uci_send(line);
+        });
+    }
+
+public:
+    explicit UCI_Search_Engine(std::size_t hash_size) : tt(hash_size) {
+    }
+
+    ~UCI_Search_Engine() override {
+        stop();
+    }
+
+    void go(Board& position, std::size_t num_threads, const Search_Limits& search_limits, bool ponder) override {
+        stop();
+        board = position;
+        threads = num_threads;
+        limits = search_limits;
+        ponder_result = UCI_Result{};
+        start(ponder);
+    }
+
+    /**
+     * Rather than changing the limits of the running search, this halts the ponder search and starts the real one on
+     * the same board. Halting takes about as long as the threads need to poll the stop signal, and the new search
+     * quickly gets back to the depth of the ponder search through the TT. Doing it this way also lets us measure that.
+     * If the ponder search already ended on its own, its result can't get any better, so it sends that one instead.
+     */
+    void ponder_hit() override {
+        if (!pondering || !worker.joinable()) {
+            return;
+        }
+        auto hit = std::chrono::steady_clock::now();
+        ponder_stats.hits++;
+        pondering = false;
+        bool ended = false;
+        {
+            std::lock_guard<std::mutex> guard(release_mutex);
+            ended = finished;
+            released = ended;
+            preempted = !ended;
+        }
+        if (ended) {
+            release_signal.notify_one();
+            worker.join();
+            return;
+        }
+        search->halt();
+        worker.join();
+        std::chrono::duration<double> latency = std::chrono::steady_clock::now() - hit;
+        preempt_latency = latency.count();
+        start(false);
+    }
+
+    void stop() override {
+        if (worker.joinable()) {
+            if (pondering) { // The GUI stops a ponder search when the opponent played something else
+                ponder_stats.misses++;
+            }
+            {
+                std::lock_guard<std::mutex> guard(release_mutex);
+                released = true;
+            }
+            release_signal.notify_one();
+            search->halt();
+            worker.join();
+        }
+        pondering = false;
+        search.reset();
+    }
+
+    void new_game() override {
+        stop();
+        tt.clear();
+    }
+};
+
+inline std::unique_ptr<UCI_Engine> make_uci_engine(const std::string& algorithm, std::size_t hash_size) {
+    if (algorithm == "lazy") {
+        return std::make_unique<UCI_Search_Engine<Locking_TT<REPLACE_LAST_ENTRY>, Lazy_SMP<true, REPLACE_LAST_ENTRY>>>(hash_size);
+    } else if (algorithm == "simple-abdada") {
+        return std::make_unique<UCI_Search_Engine<Locking_TT<REPLACE_LAST_ENTRY>,
+                                                  Simplified_ABDADA_Search<true, REPLACE_LAST_ENTRY>>>(hash_size);
+    }
+    return std::make_unique<UCI_Search_Engine<ABDADA_TT<REPLACE_LAST_ENTRY>, ABDADA_Search<true, REPLACE_LAST_ENTRY>>>(hash_size);
+}
+
+/**
+ * position [startpos | fen <fen>] [moves <move>...]
+ */
+inline void uci_position(std::istringstream& tokens, Board& board) {
+    std::string token, fen;
+    tokens >> token;
+    if (token == "startpos") {
+        fen = DEFAULT_POS;
+        tokens >> token;
+    } else if (token == "fen") {
+        while (tokens >> token && token != "moves") {
+            fen += (fen.empty() ? "" : " ") + token;
+        }
+    }
+    board.applyFen(fen);
+    while (tokens >> token) { // Only moves are left, the "moves" token itself got read above
+        board.makeMove(convertUciToMove(board, token));
+    }
+}
+
+/**
+ * go [depth <plies>] [nodes <nodes>] [movetime <ms>] [wtime <ms>] [btime <ms>] [winc <ms>] [binc <ms>]
+ *    [movestogo <moves>] [infinite] [ponder]
+ * With a clock instead of a move time we plan for the moves until the next time control, or uci_moves_to_go if the GUI
+ * doesn't say, and leave half the increment as a reserve.
+ */
+inline Search_Limits uci_go_limits(std::istringstream& tokens, const Board& board, bool& ponder) {
+    Search_Limits limits;
+    std::string token;
+    int64_t time_left = -1, increment = 0, moves_to_go = uci_moves_to_go;
+    while (tokens >> token) {
+        int64_t value = 0;
+        if (token == "infinite") {
+            limits.infinite = true;
+        } else if (token == "ponder") {
+            ponder = true;
+        } else if (tokens >> value) {
+            if (token == "depth") {
+                limits.depth = (int) std::clamp<int64_t>(value, 1, max_search_depth);
+            } else if (token == "nodes") {
+                limits.nodes = (uint64_t) std::max<int64_t>(value, 1);
+            } else if (token == "movetime") {
+                limits.time = std::chrono::milliseconds(std::max<int64_t>(value, 1));
+            } else if (token == (board.sideToMove == Chess::White ? "wtime" : "btime")) {
+                time_left = value;
+            } else if (token == (board.sideToMove == Chess::White ? "winc" : "binc")) {
+                increment = value;
+            } else if (token == "movestogo") {
+                moves_to_go = std::max<int64_t>(value, 1);
+            }
+        }
+    }
+    if (time_left >= 0 && limits.time.count() == 0) {
+        limits.time = std::chrono::milliseconds(std::max<int64_t>(time_left / moves_to_go + increment / 2, 1));
+    }
+    return limits;
+}
+
+/**
+ * Runs the engine as a UCI engine on the given input until quit or the end of the input. The search runs on a thread of
+ * its own, so the loop keeps reading and answers stop and isready right away.
+ */
+inline void uci_loop(std::istream& input) {
+    Board board;
+    board.applyFen(DEFAULT_POS);
+    std::size_t hash_size = uci_default_hash;
+    std::size_t threads = 1;
+    std::string algorithm = "abdada";
+    std::unique_ptr<UCI_Engine> engine = make_uci_engine(algorithm, hash_size);
+
+    std::string line;
+    while (std::getline(input, line)) {
+        std::istringstream tokens(line);
+        std::string command;
+        tokens >> command;
+        if (command == "uci") {
+            uci_send("id name parallel-gametree-search");
+            uci_send("id author koedem");
+            uci_send("option name Hash type spin default " + std::to_string(uci_default_hash) + " min 1 max 65536");
+            uci_send("option name Threads type spin default 1 min 1 max " + std::to_string(uci_max_threads));
+            uci_send("option name Ponder type check default false"); // Only tells the GUI it may send go ponder
+            uci_send("option name Algorithm type combo default abdada var abdada var simple-abdada var lazy");
+            uci_send("uciok");
+        } else if (command == "isready") {
+            uci_send("readyok");
+        } else if (command == "setoption") {
+            std::string token, name, value;
+            tokens >> token >> name >> token >> value; // setoption name <name> value <value>
+            engine->stop();
+            if (name == "Hash" || name == "Threads") {
+                std::size_t number;
+                try {
+                    number = std::stoull(value);
+                } catch (const std::logic_error&) { // Not a number, or too large for one: ignore the option
+                    continue;
+                }
+                if (name == "Hash") {
+                    hash_size = std::clamp<std::size_t>(number, 1, 65536);
+                    engine.reset(); // Free the old TT before allocating the new one
+                    engine = make_uci_engine(algorithm, hash_size);
+                } else {
+                    threads = std::clamp<std::size_t>(number, 1, uci_max_threads);
+                }
+            } else if (name == "Algorithm") {
+                algorithm = value;
+                engine.reset();
+                engine = make_uci_engine(algorithm, hash_size);
+            }
+        } else if (command == "ucinewgame") {
+            engine->new_game();
+        } else if (command == "position") {
+            engine->stop();
+            uci_position(tokens, board);
+        } else if (command == "go") {
+            bool ponder = false;
+            Search_Limits limits = uci_go_limits(tokens, board, ponder);
+            engine->go(board, threads, limits, ponder);
+        } else if (command == "ponderhit") {
+            engine->ponder_hit();
+        } else if (command == "stop") {
+            engine->stop();
+        } else if (command == "quit") {
+            break;
+        }
+    }
+    engine->stop();
+}
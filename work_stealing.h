@@ -0,0 +1,153 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "locking_tt.h"
+
+constexpr std::size_t job_queue_size = 16;
+
+/**
+ * A move whose subtree another thread was searching when we got to it, with the log2 size of that subtree from the TT.
+ */
+struct Deferred_Move {
+    Move move;
+    uint8_t subtree_size;
+};
+
+/**
+ * The deferred moves of one node. Fixed capacity like Movelist, so it lives on the stack and nodes never allocate.
+ */
+struct Deferred_List {
+    static constexpr int max_moves = 256;
+
+    Deferred_Move list[max_moves];
+    int size = 0;
+
+    void push_back(const Deferred_Move& deferred) {
+        assert(size < max_moves);
+        list[size++] = deferred;
+    }
+
+    [[nodiscard]] bool empty() const {
+        return size == 0;
+    }
+
+    Deferred_Move* begin() {
+        return list;
+    }
+
+    Deferred_Move* end() {
+        return list + size;
+    }
+};
+
+/**
+ * Orders deferred moves biggest subtree first, so that a thread revisiting them helps with the likely stragglers first.
+ * Equal sizes keep their order. An insertion sort in place, since std::stable_sort would allocate a buffer per node.
+ */
+inline void order_deferred(Deferred_List& deferred_moves) {
+    if constexpr (!SUBTREE_SIZES) {
+        return;
+    }
+    for (int i = 1; i < deferred_moves.size; i++) {
+        Deferred_Move deferred = deferred_moves.list[i];
+        int j = i;
+        for (; j > 0 && deferred_moves.list[j - 1].subtree_size < deferred.subtree_size; j--) {
+            deferred_moves.list[j] = deferred_moves.list[j - 1];
+        }
+        deferred_moves.list[j] = deferred;
+    }
+}
+
+/**
+ * Subtrees known to be small are cheaper to search again right away than to defer and revisit.
+ */
+inline bool worth_deferring(uint8_t subtree_size) {
+    return !SUBTREE_SIZES || subtree_size == 0 || subtree_size >= MIN_DEFERRED_SUBTREE;
+}
+
+/**
+ * Publishing subtrees known to be small for other threads costs more than it can save.
+ */
+inline bool worth_sharing(uint8_t subtree_size) {
+    return !SUBTREE_SIZES || subtree_size == 0 || subtree_size >= MIN_SHARED_SUBTREE;
+}
+
+/**
+ * A deferred move published for other threads: the position after the move, to be searched with a null window below
+ * beta at the given depth.
+ */
+struct Deferred_Job {
+    Board board;
+    Eval_Type beta = 0;
+    int depth = 0;
+};
+
+/**
+ * One queue of deferred jobs per thread. The owner publishes the moves it defers, and threads that have nothing but
+ * deferred moves left steal from the other queues, oldest job first since those are usually closest to the root.
+ * A job is only ever a hint: its result goes into the TT, where the owner finds it once it gets back to the move. So the
+ * queues are bounded and a full queue overwrites its oldest job, and a job that is stolen after the owner already
+ * finished it is just a TT hit.
+ */
+class Job_Queues {
+
+private:
+    struct alignas(64) Job_Queue {
+        Deferred_Job jobs[job_queue_size];
+        std::size_t head = 0; // The oldest job
+        std::size_t count = 0;
+        Spin_Lock lock;
+    };
+
+    std::vector<Job_Queue> queues;
+
+public:
+    explicit Job_Queues(std::size_t num_threads) : queues(num_threads) {
+    }
+
+    /**
+     * Call this before every iteration, jobs from the last one are of no use anymore.
+     */
+    void clear() {
+        for (auto& queue : queues) {
+            std::lock_guard<Spin_Lock> guard(queue.lock);
+            queue.head = 0;
+            queue.count = 0;
+        }
+    }
+
+    void publish(std::size_t thread_id, const Board& board, Eval_Type beta, int depth) {
+        Job_Queue& queue = queues[thread_id];
+        std::lock_guard<Spin_Lock> guard(queue.lock);
+        std::size_t slot = (queue.head + queue.count) % job_queue_size;
+        if (queue.count == job_queue_size) { // Full, so slot is the oldest job, which we overwrite
+            queue.head = (queue.head + 1) % job_queue_size;
+        } else {
+            queue.count++;
+        }
+        queue.jobs[slot].board = board;
+        queue.jobs[slot].beta = beta;
+        queue.jobs[slot].depth = depth;
+    }
+
+    /**
+     * Takes the oldest job of the first other thread that has one.
+     * @return true if a job was found and put into the job parameter.
+     */
+    bool steal(std::size_t thread_id, Deferred_Job& job) {
+        for (std::size_t i = 1; i < queues.size(); i++) {
+            Job_Queue& queue = queues[(thread_id + i) % queues.size()];
+            std::lock_guard<Spin_Lock> guard(queue.lock);
+            if (queue.count > 0) {
+                job.board = queue.jobs[queue.head].board;
+                job.beta = queue.jobs[queue.head].beta;
+                job.depth = queue.jobs[queue.head].depth;
+                queue.head = (queue.head + 1) % job_queue_size;
+                queue.count--;
+                return true;
+            }
+        }
+        return false;
+    }
+};